@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// NOTE(Corralx): Allocator returning Alignment aligned memory followed by Alignment bytes of padding,
+// so the last element can be read with a full width SIMD load like Embree does with the vertices
+template<typename T, size_t Alignment = 16>
+class aligned_allocator
+{
+public:
+	static_assert(Alignment >= sizeof(void*) && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two");
+
+	using value_type = T;
+
+	template<typename U>
+	struct rebind
+	{
+		using other = aligned_allocator<U, Alignment>;
+	};
+
+	aligned_allocator() = default;
+
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+	T* allocate(size_t count)
+	{
+		const size_t size = ((count * sizeof(T) + Alignment - 1) & ~(Alignment - 1)) + Alignment;
+
+#if defined(_WIN32)
+		void* memory = _aligned_malloc(size, Alignment);
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, Alignment, size) != 0)
+			memory = nullptr;
+#endif
+
+		if (!memory)
+			throw std::bad_alloc();
+		return static_cast<T*>(memory);
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+#if defined(_WIN32)
+		_aligned_free(memory);
+#else
+		free(memory);
+#endif
+	}
+
+	template<typename U>
+	bool operator==(const aligned_allocator<U, Alignment>&) const
+	{
+		return true;
+	}
+
+	template<typename U>
+	bool operator!=(const aligned_allocator<U, Alignment>&) const
+	{
+		return false;
+	}
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Non owning view of a contiguous array, the owner has to outlive it
+template<typename T>
+class array_view
+{
+public:
+	using value_type = std::remove_const_t<T>;
+
+	array_view() : _data(nullptr), _size(0) {}
+	array_view(T* data, size_t size) : _data(data), _size(size) {}
+
+	template<typename Allocator>
+	array_view(const std::vector<value_type, Allocator>& v) : _data(v.data()), _size(v.size()) {}
+
+	T* data() const
+	{
+		return _data;
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+	bool empty() const
+	{
+		return _size == 0;
+	}
+
+	T* begin() const
+	{
+		return _data;
+	}
+
+	T* end() const
+	{
+		return _data + _size;
+	}
+
+	T& operator[](size_t index) const
+	{
+		assert(index < _size);
+		return _data[index];
+	}
+
+private:
+	T* _data;
+	size_t _size;
+};
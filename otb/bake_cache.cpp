@@ -0,0 +1,173 @@
+#include "bake_cache.hpp"
+#include "occlusion.hpp"
+#include "mesh.hpp"
+#include "embree.hpp"
+#include "utils.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <random>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using image_f32 = image<pixel_format::F32>;
+using image_u32 = image<pixel_format::U32>;
+
+// NOTE(Corralx): Bump whenever the bake produces different results for the same inputs, to invalidate every entry
+static const uint32_t CACHE_VERSION = 2;
+static const uint32_t CACHE_MAGIC = 0x4342544f; // "OTBC"
+
+struct entry_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t width;
+	uint32_t height;
+	// Hash of the pixels, an entry torn by a crash or a misbehaving writer is a miss and not a wrong bake
+	uint64_t payload_hash;
+};
+
+// Unique among the processes of the machine and the calls of a process, so writers never share a temporary file
+static std::string temporary_suffix()
+{
+#if defined(_WIN32)
+	const int pid = _getpid();
+#else
+	const int pid = static_cast<int>(getpid());
+#endif
+	static std::atomic<uint64_t> counter{ 0 };
+	// NOTE(Corralx): The random part covers processes of different machines sharing the directory over the network
+	static const uint64_t nonce = (static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}();
+
+	std::ostringstream suffix;
+	suffix << ".tmp" << pid << "_" << std::hex << nonce << "_" << counter.fetch_add(1, std::memory_order_relaxed);
+	return suffix.str();
+}
+
+template<typename T>
+static uint64_t hash_value(const T& value, uint64_t seed)
+{
+	return hash_bytes(&value, sizeof(value), seed);
+}
+
+template<typename T>
+static uint64_t hash_buffer(array_view<const T> buffer, uint64_t seed)
+{
+	return hash_bytes(buffer.data(), buffer.size() * sizeof(T), seed);
+}
+
+bake_cache::bake_cache(const elk::path& directory) : _directory(directory)
+{
+}
+
+uint64_t bake_cache::key(const embree::context& ctx, const mesh_t& mesh, const occlusion_params& params, const image_u32& indices_map,
+						 const glm::mat4& transform)
+{
+	uint64_t hash = hash_value(CACHE_VERSION, ctx.content_hash());
+
+	hash = hash_buffer(mesh.vertices(), hash);
+	hash = hash_buffer(mesh.normals(), hash);
+	hash = hash_buffer(mesh.texture_coords(), hash);
+	hash = hash_buffer(mesh.faces(), hash);
+	hash = hash_value(transform, hash);
+
+	hash = hash_value(indices_map.width(), hash);
+	hash = hash_value(indices_map.height(), hash);
+	hash = hash_bytes(indices_map.raw(), indices_map.memory(), hash);
+
+	// NOTE(Corralx): Fields are hashed one by one to skip the padding, the tile size and the number of workers
+	// are left out since the samples depend only on the pixel, so they never change the result
+	hash = hash_value(params.quality, hash);
+	hash = hash_value(params.adaptive_sampling, hash);
+	hash = hash_value(params.min_quality, hash);
+	hash = hash_value(params.max_quality, hash);
+	hash = hash_value(params.target_error, hash);
+	hash = hash_value(params.min_distance, hash);
+	hash = hash_value(params.max_distance, hash);
+	hash = hash_value(params.mode, hash);
+	hash = hash_value(params.distance_steps, hash);
+	hash = hash_value(params.quadratic_attenuation, hash);
+	hash = hash_value(params.linear_attenuation, hash);
+	hash = hash_value(params.smooth_normal_interpolation, hash);
+
+	return hash;
+}
+
+elk::path bake_cache::entry_path(uint64_t key) const
+{
+	std::ostringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << key << ".otbc";
+	return _directory / name.str();
+}
+
+bool bake_cache::load(uint64_t key, const image_u32& indices_map, image_f32& image) const
+{
+	assert(image.width() == indices_map.width() && image.height() == indices_map.height());
+
+	std::ifstream file(entry_path(key).c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	entry_header header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.key != key ||
+		header.width != image.width() || header.height != image.height())
+		return false;
+
+	image_f32 cached(header.width, header.height);
+	file.read(reinterpret_cast<char*>(cached.raw()), cached.memory());
+	if (!file || hash_bytes(cached.raw(), cached.memory()) != header.payload_hash)
+		return false;
+
+	// Same contract of a bake, only the covered pixels are overwritten
+	const size_t size = static_cast<size_t>(image.width()) * image.height();
+	for (size_t i = 0; i < size; ++i)
+		if (indices_map[i] != std::numeric_limits<uint32_t>::max())
+			image[i] = cached[i];
+
+	return true;
+}
+
+bool bake_cache::store(uint64_t key, const image_f32& image) const
+{
+	const elk::path path = entry_path(key);
+
+	const std::string temporary_path = std::string(path.c_str()) + temporary_suffix();
+
+	{
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		const entry_header header{ CACHE_MAGIC, CACHE_VERSION, key, image.width(), image.height(),
+								   hash_bytes(image.raw(), image.memory()) };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(image.raw()), image.memory());
+		if (!file)
+		{
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+
+	// NOTE(Corralx): Renaming over an existing file fails on Windows, in that case another bake already stored the same entry
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+
+	return true;
+}
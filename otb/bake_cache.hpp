@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "image.hpp"
+#include "elektra/filesystem.hpp"
+#include "glm/glm.hpp"
+
+class mesh_t;
+struct occlusion_params;
+
+namespace embree
+{
+class context;
+}
+
+// NOTE(Corralx): On disk cache of finished occlusion maps, addressed by a hash of everything a bake depends on
+// Entries are written to a temporary file unique to the writer and then renamed, so bakes sharing the directory
+// never read a partial entry, the pixels are hashed too so a torn entry is a miss
+class bake_cache
+{
+public:
+	// The directory has to exist already
+	explicit bake_cache(const elk::path& directory);
+
+	// Hash of the scene geometry, the baked mesh and its placement, the indices map (so resolution and rasterization) and the params
+	static uint64_t key(const embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
+						const image<pixel_format::U32>& indices_map, const glm::mat4& transform = glm::mat4(1.f));
+
+	// Copies the pixels covered by the indices map from the cached occlusion map, returns false on a miss
+	bool load(uint64_t key, const image<pixel_format::U32>& indices_map, image<pixel_format::F32>& image) const;
+
+	bool store(uint64_t key, const image<pixel_format::F32>& image) const;
+
+private:
+	elk::path entry_path(uint64_t key) const;
+
+	elk::path _directory;
+};
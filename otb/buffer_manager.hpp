@@ -8,6 +8,8 @@
 #include "SDL2/SDL.h"
 #include "GL/gl3w.h"
 
+#include "array_view.hpp"
+
 using buffer_handle = uint32_t;
 
 enum class buffer_type : uint32_t
@@ -54,6 +56,12 @@ public:
 	// create_buffer(...) either synchronously or asynchronously
 	template<typename T>
 	size_t create_buffer(buffer_type type, buffer_usage usage, const std::vector<T>& data)
+	{
+		return create_buffer(type, usage, array_view<const T>(data));
+	}
+
+	template<typename T>
+	size_t create_buffer(buffer_type type, buffer_usage usage, array_view<const T> data)
 	{
 		auto old_context = SDL_GL_GetCurrentContext();
 		SDL_GL_MakeCurrent(window, _context);
@@ -0,0 +1,299 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+
+using hr_clock = std::chrono::high_resolution_clock;
+using millis = std::chrono::milliseconds;
+
+#pragma warning (push, 0)
+#include "tclap/CmdLine.h"
+#pragma warning (pop)
+
+#include "elektra/filesystem.hpp"
+#include "elektra/machine_specs.hpp"
+
+#include "utils.hpp"
+#include "image.hpp"
+#include "embree.hpp"
+#include "mesh.hpp"
+#include "mesh_binary.hpp"
+#include "occlusion.hpp"
+#include "bake_cache.hpp"
+#include "rasterizer.hpp"
+#include "postprocess.hpp"
+
+static constexpr const char* CLI_NAME = "Occlusion and Translucency Baker";
+static constexpr const char* CLI_VERSION = "0.1";
+
+// NOTE(Corralx): Headless baker, it never touches SDL or OpenGL so it can run without a display
+int main(int argc, char* argv[])
+{
+	try
+	{
+		TCLAP::CmdLine cmd(CLI_NAME, ' ', CLI_VERSION);
+
+		TCLAP::UnlabeledValueArg<std::string> input_arg("input", "Mesh to bake (.obj or .otbm)", true, "", "path", cmd);
+		TCLAP::ValueArg<std::string> output_arg("o", "output", "Output occlusion map (.hdr, or .png, .bmp and .tga quantized to 8 bits)", false, "occlusion_map.hdr", "path", cmd);
+		TCLAP::ValueArg<uint32_t> mesh_arg("m", "mesh", "Index of the shape to bake", false, 0, "index", cmd);
+		TCLAP::SwitchArg all_meshes_arg("", "all-meshes", "Bake every shape, the index of the shape is appended to the output name", cmd);
+		TCLAP::ValueArg<uint32_t> size_arg("s", "size", "Width and height of the occlusion map", false, 1024, "pixels", cmd);
+		TCLAP::ValueArg<uint32_t> supersampling_arg("a", "supersampling", "Supersampling factor of the UV rasterization", false, 2, "factor", cmd);
+		TCLAP::ValueArg<uint32_t> quality_arg("q", "quality", "Number of 8 rays packets per pixel", false, 1, "packets", cmd);
+		TCLAP::SwitchArg adaptive_arg("", "adaptive", "Trace packets per pixel until the occlusion converges instead of a fixed quality", cmd);
+		TCLAP::ValueArg<uint32_t> min_quality_arg("", "min-quality", "Min number of 8 rays packets per pixel when adaptive", false, 1, "packets", cmd);
+		TCLAP::ValueArg<uint32_t> max_quality_arg("", "max-quality", "Max number of 8 rays packets per pixel when adaptive", false, 8, "packets", cmd);
+		TCLAP::ValueArg<float> target_error_arg("", "target-error", "Standard error at which a pixel stops tracing when adaptive", false, .01f, "error", cmd);
+		TCLAP::ValueArg<float> min_distance_arg("", "min-distance", "Min distance to search for an occluder", false, .0001f, "distance", cmd);
+		TCLAP::ValueArg<float> max_distance_arg("", "max-distance", "Max distance to search for an occluder", false, 100.f, "distance", cmd);
+		std::vector<std::string> modes{ "distance", "binary", "stepped" };
+		TCLAP::ValuesConstraint<std::string> mode_constraint(modes);
+		TCLAP::ValueArg<std::string> mode_arg("", "mode", "How the distance of the occluders is accounted", false, "distance", &mode_constraint, cmd);
+		TCLAP::ValueArg<uint32_t> steps_arg("", "distance-steps", "Number of distance steps of the stepped mode", false, 4, "steps", cmd);
+		TCLAP::ValueArg<float> linear_arg("", "linear-attenuation", "Linear attenuation of the occlusion", false, 1.f, "factor", cmd);
+		TCLAP::ValueArg<float> quadratic_arg("", "quadratic-attenuation", "Quadratic attenuation of the occlusion", false, 1.f, "factor", cmd);
+		std::vector<std::string> qualities{ "low", "medium", "high" };
+		TCLAP::ValuesConstraint<std::string> quality_constraint(qualities);
+		TCLAP::ValueArg<std::string> build_quality_arg("", "build-quality", "Quality of the BVH build, low builds fast for previews", false, "high", &quality_constraint, cmd);
+		TCLAP::SwitchArg compact_arg("", "compact-bvh", "Build a compressed BVH using less memory", cmd);
+		TCLAP::SwitchArg no_robust_arg("", "no-robust", "Allow the traversal optimizations that can miss hits on shared edges", cmd);
+		std::vector<uint32_t> widths{ 4, 8, 16 };
+		TCLAP::ValuesConstraint<uint32_t> width_constraint(widths);
+		TCLAP::ValueArg<uint32_t> packet_width_arg("", "packet-width", "Rays per packet when the rays are not traced as a stream", false, 8, &width_constraint, cmd);
+		TCLAP::ValueArg<uint32_t> workers_arg("j", "workers", "Number of worker threads (0 uses every core)", false, 0, "threads", cmd);
+		TCLAP::ValueArg<uint32_t> dilation_arg("", "dilation", "Texels the UV islands are padded by before blurring (0 disables)", false, 0, "texels", cmd);
+		TCLAP::SwitchArg dilate_all_arg("", "dilate-all", "Pad the UV islands until they fill the whole map", cmd);
+		TCLAP::ValueArg<uint32_t> blur_pass_arg("", "blur-passes", "Number of gaussian blur passes", false, 3, "passes", cmd);
+		TCLAP::ValueArg<uint32_t> blur_kernel_arg("", "blur-kernel", "Size of the gaussian blur kernel", false, 3, "size", cmd);
+		TCLAP::ValueArg<float> blur_sigma_arg("", "blur-sigma", "Sigma of the gaussian blur kernel", false, 1.f, "sigma", cmd);
+		TCLAP::SwitchArg bilateral_arg("", "bilateral", "Blur only across texels of the same UV island with similar normals, several times slower than the plain blur", cmd);
+		TCLAP::ValueArg<uint32_t> normal_exponent_arg("", "normal-exponent", "Exponent of the cosine between the normals weighting the bilateral blur", false, 8, "exponent", cmd);
+		TCLAP::ValueArg<std::string> binary_arg("", "write-binary", "Also save the loaded meshes in the binary format (.otbm), which loads without parsing", false, "", "path", cmd);
+		TCLAP::SwitchArg verify_arg("", "verify", "Hash and check the whole binary mesh (.otbm) on load instead of only its layout", cmd);
+		TCLAP::ValueArg<std::string> cache_arg("", "cache", "Directory of the bake cache, unchanged bakes are loaded from it", false, "", "path", cmd);
+		TCLAP::SwitchArg flat_normals_arg("", "flat-normals", "Use the mean of the vertex normals instead of interpolating them", cmd);
+		std::vector<std::string> dithers{ "none", "bayer", "blue-noise", "error-diffusion" };
+		TCLAP::ValuesConstraint<std::string> dither_constraint(dithers);
+		TCLAP::ValueArg<std::string> dither_arg("", "dither", "Dithering of the 8 bits maps (.png, .bmp and .tga)", false, "blue-noise", &dither_constraint, cmd);
+		TCLAP::SwitchArg no_invert_arg("", "no-invert", "Save the raw occlusion instead of the inverted map", cmd);
+
+		cmd.parse(argc, argv);
+
+		if (size_arg.getValue() == 0 || quality_arg.getValue() == 0 || supersampling_arg.getValue() == 0 || steps_arg.getValue() == 0)
+		{
+			std::cerr << "Size, quality, supersampling and distance steps must be greater than zero!" << std::endl;
+			return 1;
+		}
+
+		if (adaptive_arg.getValue() && (min_quality_arg.getValue() == 0 || min_quality_arg.getValue() > max_quality_arg.getValue()))
+		{
+			std::cerr << "Min quality must be greater than zero and not greater than max quality!" << std::endl;
+			return 1;
+		}
+
+		std::cout << "Loading meshes..." << std::endl;
+		elk::path mesh_path(input_arg.getValue());
+		auto start_time = hr_clock::now();
+		auto shapes = load_meshes(mesh_path, verify_arg.getValue());
+		auto end_time = hr_clock::now();
+		std::cout << "Loading has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+		if (shapes.empty())
+		{
+			std::cerr << "Error loading meshes!" << std::endl;
+			return 1;
+		}
+
+		if (!binary_arg.getValue().empty() && !write_meshes_binary(elk::path(binary_arg.getValue()), shapes))
+		{
+			std::cerr << "Error saving " << binary_arg.getValue() << "!" << std::endl;
+			return 1;
+		}
+
+		const uint32_t mesh_index = mesh_arg.getValue();
+		if (mesh_index >= shapes.size())
+		{
+			std::cerr << "Mesh index " << mesh_index << " out of range, shapes found: " << shapes.size() << std::endl;
+			return 1;
+		}
+
+		std::cout << "Initializing Embree..." << std::endl;
+		embree::scene_options scene_options{};
+		if (build_quality_arg.getValue() == "low")
+			scene_options.quality = embree::build_quality::LOW;
+		else if (build_quality_arg.getValue() == "medium")
+			scene_options.quality = embree::build_quality::MEDIUM;
+		else
+			scene_options.quality = embree::build_quality::HIGH;
+		scene_options.compact = compact_arg.getValue();
+		scene_options.robust = !no_robust_arg.getValue();
+		if (packet_width_arg.getValue() == 4)
+			scene_options.width = embree::packet_width::WIDTH_4;
+		else if (packet_width_arg.getValue() == 16)
+			scene_options.width = embree::packet_width::WIDTH_16;
+		else
+			scene_options.width = embree::packet_width::WIDTH_8;
+
+		embree::context context(scene_options);
+		for (const mesh_t& m : shapes)
+			context.add_mesh(m);
+		if (!context.commit())
+		{
+			std::cerr << "Error initializing Embree!" << std::endl;
+			return 1;
+		}
+		const embree::build_stats& stats = context.stats();
+		std::cout << "BVH of " << stats.triangles << " triangles in " << stats.geometries << " meshes occupies " << stats.memory << " bytes!" << std::endl;
+		std::cout << "BVH build has taken " << static_cast<uint32_t>(stats.build_milliseconds) << " ms!" << std::endl;
+
+		const uint32_t map_size = size_arg.getValue();
+
+		const uint32_t workers = workers_arg.getValue() != 0 ? workers_arg.getValue() : elk::number_of_cores();
+
+		occlusion_params params{};
+		params.min_distance = min_distance_arg.getValue();
+		params.max_distance = max_distance_arg.getValue();
+		params.smooth_normal_interpolation = !flat_normals_arg.getValue();
+		params.linear_attenuation = linear_arg.getValue();
+		params.quadratic_attenuation = quadratic_arg.getValue();
+		params.quality = quality_arg.getValue();
+		params.adaptive_sampling = adaptive_arg.getValue();
+		params.min_quality = min_quality_arg.getValue();
+		params.max_quality = max_quality_arg.getValue();
+		params.target_error = target_error_arg.getValue();
+		params.distance_steps = steps_arg.getValue();
+		if (mode_arg.getValue() == "binary")
+			params.mode = occlusion_mode::BINARY;
+		else if (mode_arg.getValue() == "stepped")
+			params.mode = occlusion_mode::STEPPED;
+		else
+			params.mode = occlusion_mode::DISTANCE;
+		params.worker_num = static_cast<uint8_t>(std::min(workers, 255u));
+
+		const uint32_t padding = dilate_all_arg.getValue() ? DILATE_WHOLE_MAP : dilation_arg.getValue();
+
+		// The index of the shape goes before the extension, occlusion_map.hdr becomes occlusion_map_0.hdr and so on
+		const std::string& output = output_arg.getValue();
+		const size_t separator = output.find_last_of("/\\");
+		size_t extension = output.find_last_of('.');
+		if (extension == std::string::npos || (separator != std::string::npos && extension < separator))
+			extension = output.size();
+
+		std::string extension_name = output.substr(extension);
+		std::transform(extension_name.begin(), extension_name.end(), extension_name.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+		const bool quantized = extension_name == ".png" || extension_name == ".bmp" || extension_name == ".tga";
+		const image_extension quantized_extension = extension_name == ".bmp" ? image_extension::BMP :
+													extension_name == ".tga" ? image_extension::TGA : image_extension::PNG;
+
+		dither_mode dither = dither_mode::BLUE_NOISE;
+		if (dither_arg.getValue() == "none")
+			dither = dither_mode::NONE;
+		else if (dither_arg.getValue() == "bayer")
+			dither = dither_mode::BAYER;
+		else if (dither_arg.getValue() == "error-diffusion")
+			dither = dither_mode::ERROR_DIFFUSION;
+
+		// The bilateral blur ignores the empty texels, so the islands are padded after it and before the plain blur
+		// The 8 bits maps are dithered and quantized by the last sweep of the pipeline
+		auto postprocess_and_save = [&](image<pixel_format::F32>& occlusion_map, const mesh_t& mesh,
+										const image<pixel_format::U32>& indices_map, const std::string& path)
+		{
+			const uint32_t passes = blur_pass_arg.getValue();
+			postprocess_pipeline pipeline;
+			if (bilateral_arg.getValue() && passes > 0)
+				pipeline.bilateral_blur(mesh, indices_map, passes, blur_kernel_arg.getValue(), blur_sigma_arg.getValue(), normal_exponent_arg.getValue());
+			if (padding > 0)
+				pipeline.dilate(indices_map, padding);
+			if (!bilateral_arg.getValue() && passes > 0)
+				pipeline.gaussian_blur(passes, blur_kernel_arg.getValue(), blur_sigma_arg.getValue());
+			if (!no_invert_arg.getValue())
+				pipeline.invert();
+
+			if (!quantized)
+			{
+				pipeline.run(occlusion_map).get();
+				return write_image(elk::path(path), occlusion_map);
+			}
+
+			image<pixel_format::U8> quantized_map(occlusion_map.width(), occlusion_map.height());
+			pipeline.run(occlusion_map, quantized_map, dither).get();
+			return write_image(elk::path(path), quantized_map, quantized_extension);
+		};
+
+		if (all_meshes_arg.getValue())
+		{
+			std::vector<bake_job> jobs;
+			jobs.reserve(shapes.size());
+			for (const mesh_t& m : shapes)
+			{
+				jobs.emplace_back(m, map_size, map_size, params);
+				jobs.back().supersampling = static_cast<uint8_t>(supersampling_arg.getValue());
+			}
+
+			std::cout << "Calculating " << jobs.size() << " occlusion maps..." << std::endl;
+			start_time = hr_clock::now();
+			if (!cache_arg.getValue().empty())
+			{
+				bake_cache cache(elk::path(cache_arg.getValue()));
+				bake_scene(context, jobs, workers, cache).get();
+			}
+			else
+				bake_scene(context, jobs, workers).get();
+			end_time = hr_clock::now();
+			std::cout << "Calculation has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+
+			std::cout << "Postprocessing and saving occlusion maps..." << std::endl;
+			for (size_t i = 0; i < jobs.size(); ++i)
+			{
+				const std::string path = output.substr(0, extension) + "_" + std::to_string(i) + output.substr(extension);
+				if (!postprocess_and_save(jobs[i].occlusion_map, *jobs[i].mesh, jobs[i].indices_map, path))
+				{
+					std::cerr << "Error saving " << path << "!" << std::endl;
+					return 1;
+				}
+			}
+			std::cout << "Done!" << std::endl;
+			return 0;
+		}
+
+		std::cout << "Rasterizing UVs..." << std::endl;
+		image<pixel_format::U32> indices_map(map_size, map_size);
+		indices_map.reset(255);
+		start_time = hr_clock::now();
+		rasterize_triangle_software(shapes[mesh_index], indices_map, static_cast<uint8_t>(supersampling_arg.getValue())).get();
+		end_time = hr_clock::now();
+		std::cout << "Rasterizing has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+
+		std::cout << "Calculating occlusion map..." << std::endl;
+		image<pixel_format::F32> occlusion_map(map_size, map_size);
+		occlusion_map.reset(0);
+
+		start_time = hr_clock::now();
+		if (!cache_arg.getValue().empty())
+		{
+			bake_cache cache(elk::path(cache_arg.getValue()));
+			generate_occlusion_map(context, shapes[mesh_index], params, indices_map, occlusion_map, cache).get();
+		}
+		else
+			generate_occlusion_map(context, shapes[mesh_index], params, indices_map, occlusion_map).get();
+		end_time = hr_clock::now();
+		std::cout << "Calculation has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+
+		std::cout << "Postprocessing and saving occlusion map..." << std::endl;
+		start_time = hr_clock::now();
+		if (!postprocess_and_save(occlusion_map, shapes[mesh_index], indices_map, output))
+		{
+			std::cerr << "Error saving " << output << "!" << std::endl;
+			return 1;
+		}
+		end_time = hr_clock::now();
+		std::cout << "Postprocessing and saving has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+		std::cout << "Done!" << std::endl;
+	}
+	catch (TCLAP::ArgException& e)
+	{
+		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,12 +1,10 @@
 #include "embree.hpp"
 #include "mesh.hpp"
-#include "elektra/platforms.hpp"
+#include "utils.hpp"
 
-// TODO(Corralx): Figure out other os'es headers?
-#ifdef ELK_PLATFORM_WINDOWS
+// NOTE(Corralx): Needed on every platform for the flush to zero and denormals macros
 #include <xmmintrin.h>
 #include <pmmintrin.h>
-#endif
 
 #pragma warning (push, 0)
 #include "embree2/rtcore.h"
@@ -14,25 +12,13 @@
 #pragma warning (pop)
 
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 namespace embree
 {
 
-struct vertex
-{
-	float x;
-	float y;
-	float z;
-	float _padding;
-};
-
-struct triangle
-{
-	int32_t v0;
-	int32_t v1;
-	int32_t v2;
-};
-
 struct RTCORE_ALIGN(16) ray_mask
 {
 	uint32_t _[8];
@@ -50,79 +36,282 @@ static const ray_mask mask =
 	0xFFFFFFFF
 };
 
-context::context() : _device(nullptr, rtcDeleteDevice), _scene(nullptr, rtcDeleteScene), _geometry()
+#if defined(RTCORE_VERSION) && RTCORE_VERSION >= 21500
+// NOTE(Corralx): Embree 2.15 and later trace SoA streams of any size natively
+#define OTB_EMBREE_RAY_STREAM 1
+static const int STREAM_ALGORITHM_FLAGS = RTC_INTERSECT_STREAM;
+#else
+// Older versions trace the stream as a sequence of packets of the width in the scene options
+#define OTB_EMBREE_RAY_STREAM 0
+static const int STREAM_ALGORITHM_FLAGS = 0;
+#endif
+
+// Hits on an instance report the instance, not the geometry of its prototype
+static mesh_id hit_id(uint32_t geometry, uint32_t instance)
+{
+	return instance != NO_HIT_ID ? instance : geometry;
+}
+
+// Bytes allocated by every Embree device, updated by the memory monitor
+static std::atomic<int64_t> allocated_memory(0);
+
+static bool memory_monitor(const ssize_t bytes, const bool)
+{
+	allocated_memory += bytes;
+	return true;
+}
+
+static int scene_flags(const scene_options& options)
+{
+	int flags = RTC_SCENE_INCOHERENT;
+	switch (options.quality)
+	{
+		case build_quality::LOW:
+			flags |= RTC_SCENE_DYNAMIC;
+			break;
+
+		case build_quality::MEDIUM:
+			flags |= RTC_SCENE_STATIC;
+			break;
+
+		case build_quality::HIGH:
+			flags |= RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY;
+			break;
+	}
+
+	if (options.compact)
+		flags |= RTC_SCENE_COMPACT;
+	if (options.robust)
+		flags |= RTC_SCENE_ROBUST;
+	return flags;
+}
+
+// The 8 wide packets are always enabled for the single packet queries
+static int algorithm_flags(const scene_options& options)
+{
+	int flags = RTC_INTERSECT8 | STREAM_ALGORITHM_FLAGS;
+	switch (options.width)
+	{
+		case packet_width::WIDTH_4:
+			flags |= RTC_INTERSECT4;
+			break;
+
+		case packet_width::WIDTH_8:
+			break;
+
+		case packet_width::WIDTH_16:
+			flags |= RTC_INTERSECT16;
+			break;
+	}
+	return flags;
+}
+
+// Runs f and adds the time it takes and the memory it allocates to the stats
+template<typename Func>
+static void measure(build_stats& stats, bool timed, Func f)
+{
+	const int64_t memory_before = allocated_memory;
+	const auto start_time = std::chrono::high_resolution_clock::now();
+
+	f();
+
+	const auto end_time = std::chrono::high_resolution_clock::now();
+	if (timed)
+		stats.build_milliseconds = std::chrono::duration<float, std::milli>(end_time - start_time).count();
+	stats.memory += allocated_memory - memory_before;
+}
+
+// Creates a triangle mesh in the scene, sharing the mesh arrays with Embree instead of copying them
+// NOTE(Corralx): The mesh storage is aligned and padded for it, see mesh_t
+static mesh_id new_triangle_mesh(RTCScene scene, const scene_options& options, const mesh_t& mesh)
+{
+	const auto vertices = mesh.vertices();
+	const auto faces = mesh.faces();
+
+	assert(faces.size() > 0);
+	assert(vertices.size() > 0);
+	assert(reinterpret_cast<uintptr_t>(vertices.data()) % 16 == 0);
+
+	// The low quality build goes through the Morton builder, only used for dynamic geometry
+	const int geometry_flags = options.quality == build_quality::LOW ? RTC_GEOMETRY_DYNAMIC : RTC_GEOMETRY_STATIC;
+
+	const mesh_id id = rtcNewTriangleMesh(scene, geometry_flags, faces.size(), vertices.size());
+	rtcSetBuffer(scene, id, RTC_VERTEX_BUFFER, vertices.data(), 0, sizeof(vertex_t));
+	rtcSetBuffer(scene, id, RTC_INDEX_BUFFER, faces.data(), 0, sizeof(face_t));
+	return id;
+}
+
+// Only the geometry affects the traced rays, normals and UVs are left out
+static uint64_t geometry_hash(const mesh_t& mesh)
+{
+	const auto vertices = mesh.vertices();
+	const auto faces = mesh.faces();
+
+	const uint64_t hash = hash_bytes(vertices.data(), vertices.size() * sizeof(vertex_t));
+	return hash_bytes(faces.data(), faces.size() * sizeof(face_t), hash);
+}
+
+context::context(const scene_options& options) : _device(nullptr, rtcDeleteDevice), _scene(nullptr, rtcDeleteScene),
+	_options(options), _stats(), _geometry(), _prototypes(), _hash_mutex(std::make_unique<std::mutex>())
 {
 	// Setting the CPU register flags
 	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
-	_device.reset(rtcNewDevice());
-	auto scene_ptr = rtcDeviceNewScene(_device.get(), RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT |
-									   RTC_SCENE_HIGH_QUALITY | RTC_SCENE_ROBUST, RTC_INTERSECT8);
-	_scene.reset(scene_ptr);
+	measure(_stats, false, [&]()
+	{
+		_device.reset(rtcNewDevice());
+		rtcDeviceSetMemoryMonitorFunction(_device.get(), memory_monitor);
+		_scene.reset(rtcDeviceNewScene(_device.get(), scene_flags(_options), algorithm_flags(_options)));
+	});
 
 	assert(_scene);
 	assert(_device);
 }
 
+// NOTE(Corralx): The instances reference the prototype scenes, so the scene goes before the prototypes
 context::~context()
 {
-	for (mesh_id id : _geometry)
-		rtcDeleteGeometry(_scene.get(), id);
+	for (const geometry& g : _geometry)
+		rtcDeleteGeometry(_scene.get(), g.id);
+	_scene.reset();
+
+	for (const prototype& p : _prototypes)
+		rtcDeleteGeometry(p.scene.get(), p.id);
+	_prototypes.clear();
 }
 
 mesh_id context::add_mesh(const mesh_t& mesh)
 {
-	size_t num_indices = mesh.faces().size();
-	size_t num_vertices = mesh.vertices().size();
+	mesh_id id = 0;
+	measure(_stats, false, [&]() { id = new_triangle_mesh(_scene.get(), _options, mesh); });
 
-	assert(num_indices > 0);
-	assert(num_vertices > 0);
+	_geometry.push_back({ id, &mesh, 0, 0, 0, false, mesh.faces().size(), false });
 
-	auto scene_ptr = _scene.get();
-
-	mesh_id id = rtcNewTriangleMesh(scene_ptr, RTC_GEOMETRY_STATIC, num_indices, num_vertices);
+	++_stats.geometries;
+	_stats.triangles += mesh.faces().size();
+	return id;
+}
 
-	auto& vertices = mesh.vertices();
-	vertex* embree_vertices = (vertex*)rtcMapBuffer(scene_ptr, id, RTC_VERTEX_BUFFER);
-	for (uint32_t i = 0; i < num_vertices; ++i)
+prototype_id context::add_prototype(const mesh_t& mesh)
+{
+	handle_ptr<__RTCScene> scene(nullptr, rtcDeleteScene);
+	mesh_id id = 0;
+	measure(_stats, false, [&]()
 	{
-		embree_vertices[i].x = vertices[i].x;
-		embree_vertices[i].y = vertices[i].y;
-		embree_vertices[i].z = vertices[i].z;
-		embree_vertices[i]._padding = .0f;
-	}
-	rtcUnmapBuffer(scene_ptr, id, RTC_VERTEX_BUFFER);
+		scene.reset(rtcDeviceNewScene(_device.get(), scene_flags(_options), algorithm_flags(_options)));
+		id = new_triangle_mesh(scene.get(), _options, mesh);
+	});
+
+	_prototypes.push_back({ std::move(scene), id, &mesh, 0, false, false });
+
+	++_stats.geometries;
+	_stats.triangles += mesh.faces().size();
+	return static_cast<prototype_id>(_prototypes.size() - 1);
+}
+
+mesh_id context::add_instance(prototype_id prototype, const glm::mat4& transform)
+{
+	assert(prototype < _prototypes.size());
 
-	auto& faces = mesh.faces();
-	triangle* embree_triangles = (triangle*)rtcMapBuffer(scene_ptr, id, RTC_INDEX_BUFFER);
-	for (uint32_t i = 0; i < num_indices; ++i)
+	// Embree takes the 3x4 affine part, one column after the other
+	float columns[12];
+	for (uint32_t c = 0; c < 4; ++c)
+		for (uint32_t r = 0; r < 3; ++r)
+			columns[c * 3 + r] = transform[c][r];
+
+	mesh_id id = 0;
+	measure(_stats, false, [&]()
 	{
-		embree_triangles[i].v0 = faces[i].v0;
-		embree_triangles[i].v1 = faces[i].v1;
-		embree_triangles[i].v2 = faces[i].v2;
-	}
-	rtcUnmapBuffer(scene_ptr, id, RTC_INDEX_BUFFER);
+		id = rtcNewInstance(_scene.get(), _prototypes[prototype].scene.get());
+		rtcSetTransform(_scene.get(), id, RTC_MATRIX_COLUMN_MAJOR, columns);
+	});
+
+	_geometry.push_back({ id, nullptr, prototype, hash_bytes(columns, sizeof(columns)), 0, false, 0, true });
 
-	_geometry.push_back(id);
+	++_stats.instances;
 	return id;
 }
 
 void context::remove_mesh(mesh_id id)
 {
-	auto pos = std::find(std::begin(_geometry), std::end(_geometry), id);
+	auto pos = std::find_if(std::begin(_geometry), std::end(_geometry), [id](const geometry& g) { return g.id == id; });
 	assert(pos != std::end(_geometry));
 
+	if (pos->instance)
+		--_stats.instances;
+	else
+		--_stats.geometries;
+	_stats.triangles -= pos->triangles;
+
 	_geometry.erase(pos);
-	rtcDeleteGeometry(_scene.get(), id);
+	measure(_stats, false, [&]() { rtcDeleteGeometry(_scene.get(), id); });
 }
 
+// Prototypes added since the last commit are built first, the instances need their BVH
 bool context::commit()
 {
-	rtcCommit(_scene.get());
+	measure(_stats, true, [&]()
+	{
+		for (prototype& p : _prototypes)
+		{
+			if (!p.committed)
+			{
+				rtcCommit(p.scene.get());
+				p.committed = true;
+			}
+		}
+
+		rtcCommit(_scene.get());
+	});
 	return !has_error();
 }
 
+const scene_options& context::options() const
+{
+	return _options;
+}
+
+const build_stats& context::stats() const
+{
+	return _stats;
+}
+
+// NOTE(Corralx): Called with the hash mutex held
+uint64_t context::prototype_hash(const prototype& p) const
+{
+	if (!p.hashed)
+	{
+		p.hash = geometry_hash(*p.mesh);
+		p.hashed = true;
+	}
+
+	return p.hash;
+}
+
+uint64_t context::content_hash() const
+{
+	std::lock_guard<std::mutex> lock(*_hash_mutex);
+
+	std::vector<uint64_t> hashes(_geometry.size());
+	for (size_t g = 0; g < _geometry.size(); ++g)
+	{
+		const geometry& geo = _geometry[g];
+		if (!geo.hashed)
+		{
+			if (geo.instance)
+				geo.hash = hash_bytes(&geo.transform_hash, sizeof(uint64_t), prototype_hash(_prototypes[geo.prototype]));
+			else
+				geo.hash = geometry_hash(*geo.mesh);
+			geo.hashed = true;
+		}
+
+		hashes[g] = geo.hash;
+	}
+
+	return hash_bytes(hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
 bool context::has_error()
 {
 	return rtcDeviceGetError(_device.get()) != RTC_NO_ERROR;
@@ -145,6 +334,7 @@ intersect_result context::intersect(const ray& r, float max_distance, float min_
 		ray8.tfar[ray_id] = max_distance;
 
 		ray8.geomID[ray_id] = NO_HIT_ID;
+		ray8.instID[ray_id] = NO_HIT_ID;
 	}
 
 	rtcIntersect8(&mask, _scene.get(), ray8);
@@ -152,11 +342,11 @@ intersect_result context::intersect(const ray& r, float max_distance, float min_
 	intersect_result res{};
 	for (uint32_t ray_id = 0; ray_id < 8; ++ray_id)
 	{
-		res.ids[ray_id] = ray8.geomID[ray_id];
+		res.ids[ray_id] = hit_id(ray8.geomID[ray_id], ray8.instID[ray_id]);
 		res.distances[ray_id] = ray8.tfar[ray_id];
 	}
 
-	return std::move(res);
+	return res;
 }
 
 occluded_result context::occluded(const ray& r, float max_distance, float min_distance)
@@ -184,7 +374,236 @@ occluded_result context::occluded(const ray& r, float max_distance, float min_di
 	for (uint32_t ray_id = 0; ray_id < 8; ++ray_id)
 		res[ray_id] = (ray8.geomID[ray_id] != NO_HIT_ID) ? true : false;
 
-	return std::move(res);
+	return res;
+}
+
+#if OTB_EMBREE_RAY_STREAM
+
+// Per thread storage for the hit data Embree writes but the stream does not expose
+struct stream_scratch
+{
+	std::vector<float> tnear;
+	std::vector<float> geometric_normal_x;
+	std::vector<float> geometric_normal_y;
+	std::vector<float> geometric_normal_z;
+	std::vector<float> u;
+	std::vector<float> v;
+	std::vector<uint32_t> primitive_ids;
+	std::vector<uint32_t> instance_ids;
+
+	RTCRayNp setup(ray_stream& rays, float max_distance, float min_distance)
+	{
+		const size_t size = rays.size();
+		if (tnear.size() < size)
+		{
+			tnear.resize(size);
+			geometric_normal_x.resize(size);
+			geometric_normal_y.resize(size);
+			geometric_normal_z.resize(size);
+			u.resize(size);
+			v.resize(size);
+			primitive_ids.resize(size);
+			instance_ids.resize(size);
+		}
+
+		std::fill(tnear.begin(), tnear.begin() + size, min_distance);
+		std::fill(rays.distances.begin(), rays.distances.end(), max_distance);
+		std::fill(rays.ids.begin(), rays.ids.end(), NO_HIT_ID);
+		std::fill(instance_ids.begin(), instance_ids.begin() + size, NO_HIT_ID);
+
+		RTCRayNp stream{};
+		stream.orgx = rays.origin_x.data();
+		stream.orgy = rays.origin_y.data();
+		stream.orgz = rays.origin_z.data();
+		stream.dirx = rays.direction_x.data();
+		stream.diry = rays.direction_y.data();
+		stream.dirz = rays.direction_z.data();
+		stream.tnear = tnear.data();
+		stream.tfar = rays.distances.data();
+		stream.Ngx = geometric_normal_x.data();
+		stream.Ngy = geometric_normal_y.data();
+		stream.Ngz = geometric_normal_z.data();
+		stream.u = u.data();
+		stream.v = v.data();
+		stream.geomID = rays.ids.data();
+		stream.primID = primitive_ids.data();
+		stream.instID = instance_ids.data();
+		return stream;
+	}
+};
+
+static thread_local stream_scratch scratch;
+
+void context::intersect(ray_stream& rays, float max_distance, float min_distance)
+{
+	if (rays.size() == 0)
+		return;
+
+	RTCRayNp stream = scratch.setup(rays, max_distance, min_distance);
+
+	RTCIntersectContext intersect_context{};
+	intersect_context.flags = RTC_INTERSECT_INCOHERENT;
+	rtcIntersectNp(_scene.get(), &intersect_context, stream, rays.size());
+
+	if (_stats.instances > 0)
+		for (size_t r = 0; r < rays.size(); ++r)
+			rays.ids[r] = hit_id(rays.ids[r], scratch.instance_ids[r]);
+}
+
+void context::occluded(ray_stream& rays, float max_distance, float min_distance)
+{
+	if (rays.size() == 0)
+		return;
+
+	RTCRayNp stream = scratch.setup(rays, max_distance, min_distance);
+
+	RTCIntersectContext intersect_context{};
+	intersect_context.flags = RTC_INTERSECT_INCOHERENT;
+	rtcOccludedNp(_scene.get(), &intersect_context, stream, rays.size());
+}
+
+#else
+
+template<uint32_t Width>
+struct RTCORE_ALIGN(64) packet_mask
+{
+	uint32_t _[Width];
+};
+
+// Embree entry points of every packet width
+template<typename Packet>
+struct packet_traits;
+
+template<>
+struct packet_traits<RTCRay4>
+{
+	static const uint32_t width = 4;
+	static void intersect(const void* valid, RTCScene scene, RTCRay4& packet) { rtcIntersect4(valid, scene, packet); }
+	static void occluded(const void* valid, RTCScene scene, RTCRay4& packet) { rtcOccluded4(valid, scene, packet); }
+};
+
+template<>
+struct packet_traits<RTCRay8>
+{
+	static const uint32_t width = 8;
+	static void intersect(const void* valid, RTCScene scene, RTCRay8& packet) { rtcIntersect8(valid, scene, packet); }
+	static void occluded(const void* valid, RTCScene scene, RTCRay8& packet) { rtcOccluded8(valid, scene, packet); }
+};
+
+template<>
+struct packet_traits<RTCRay16>
+{
+	static const uint32_t width = 16;
+	static void intersect(const void* valid, RTCScene scene, RTCRay16& packet) { rtcIntersect16(valid, scene, packet); }
+	static void occluded(const void* valid, RTCScene scene, RTCRay16& packet) { rtcOccluded16(valid, scene, packet); }
+};
+
+// Loads the rays [first, first + count) of the stream into a packet, masking off the unused lanes
+template<typename Packet, uint32_t Width>
+static void load_packet(const ray_stream& rays, size_t first, size_t count, float max_distance, float min_distance,
+						Packet& packet, packet_mask<Width>& valid)
+{
+	for (uint32_t ray_id = 0; ray_id < Width; ++ray_id)
+	{
+		const size_t index = first + std::min<size_t>(ray_id, count - 1);
+		valid._[ray_id] = ray_id < count ? 0xFFFFFFFF : 0;
+
+		packet.orgx[ray_id] = rays.origin_x[index];
+		packet.orgy[ray_id] = rays.origin_y[index];
+		packet.orgz[ray_id] = rays.origin_z[index];
+
+		packet.dirx[ray_id] = rays.direction_x[index];
+		packet.diry[ray_id] = rays.direction_y[index];
+		packet.dirz[ray_id] = rays.direction_z[index];
+
+		packet.tnear[ray_id] = min_distance;
+		packet.tfar[ray_id] = max_distance;
+
+		packet.geomID[ray_id] = NO_HIT_ID;
+		packet.instID[ray_id] = NO_HIT_ID;
+	}
+}
+
+template<typename Packet>
+static void intersect_packets(RTCScene scene, ray_stream& rays, float max_distance, float min_distance)
+{
+	const uint32_t width = packet_traits<Packet>::width;
+	Packet packet{};
+	packet_mask<packet_traits<Packet>::width> valid{};
+
+	for (size_t first = 0; first < rays.size(); first += width)
+	{
+		const size_t count = std::min<size_t>(width, rays.size() - first);
+		load_packet(rays, first, count, max_distance, min_distance, packet, valid);
+
+		packet_traits<Packet>::intersect(&valid, scene, packet);
+
+		for (uint32_t ray_id = 0; ray_id < count; ++ray_id)
+		{
+			rays.ids[first + ray_id] = hit_id(packet.geomID[ray_id], packet.instID[ray_id]);
+			rays.distances[first + ray_id] = packet.tfar[ray_id];
+		}
+	}
 }
 
+template<typename Packet>
+static void occluded_packets(RTCScene scene, ray_stream& rays, float max_distance, float min_distance)
+{
+	const uint32_t width = packet_traits<Packet>::width;
+	Packet packet{};
+	packet_mask<packet_traits<Packet>::width> valid{};
+
+	for (size_t first = 0; first < rays.size(); first += width)
+	{
+		const size_t count = std::min<size_t>(width, rays.size() - first);
+		load_packet(rays, first, count, max_distance, min_distance, packet, valid);
+
+		packet_traits<Packet>::occluded(&valid, scene, packet);
+
+		for (uint32_t ray_id = 0; ray_id < count; ++ray_id)
+		{
+			rays.ids[first + ray_id] = packet.geomID[ray_id];
+			rays.distances[first + ray_id] = max_distance;
+		}
+	}
+}
+
+void context::intersect(ray_stream& rays, float max_distance, float min_distance)
+{
+	switch (_options.width)
+	{
+		case packet_width::WIDTH_4:
+			intersect_packets<RTCRay4>(_scene.get(), rays, max_distance, min_distance);
+			break;
+
+		case packet_width::WIDTH_8:
+			intersect_packets<RTCRay8>(_scene.get(), rays, max_distance, min_distance);
+			break;
+
+		case packet_width::WIDTH_16:
+			intersect_packets<RTCRay16>(_scene.get(), rays, max_distance, min_distance);
+			break;
+	}
+}
+
+void context::occluded(ray_stream& rays, float max_distance, float min_distance)
+{
+	switch (_options.width)
+	{
+		case packet_width::WIDTH_4:
+			occluded_packets<RTCRay4>(_scene.get(), rays, max_distance, min_distance);
+			break;
+
+		case packet_width::WIDTH_8:
+			occluded_packets<RTCRay8>(_scene.get(), rays, max_distance, min_distance);
+			break;
+
+		case packet_width::WIDTH_16:
+			occluded_packets<RTCRay16>(_scene.get(), rays, max_distance, min_distance);
+			break;
+	}
+}
+
+#endif
+
 }
@@ -5,6 +5,7 @@
 #include <limits>
 #include <array>
 #include <memory>
+#include <mutex>
 
 #include "glm/glm.hpp"
 
@@ -19,6 +20,7 @@ template<typename T>
 using handle_ptr = std::unique_ptr<T, void(*)(T *)>;
 
 using mesh_id = uint32_t;
+using prototype_id = uint32_t;
 
 const mesh_id NO_HIT_ID = std::numeric_limits<mesh_id>::max();
 
@@ -36,10 +38,109 @@ struct ray
 	std::array<glm::vec3, 8> directions;
 };
 
+// Arbitrary sized batch of rays in SoA layout, traced in place
+/* NOTE(Corralx): After intersect(...), ids contains the hit mesh or instance (NO_HIT_ID on a miss) and distances the hit distance
+   After occluded(...), ids is NO_HIT_ID only for the rays not blocked before max_distance */
+struct ray_stream
+{
+	std::vector<float> origin_x;
+	std::vector<float> origin_y;
+	std::vector<float> origin_z;
+	std::vector<float> direction_x;
+	std::vector<float> direction_y;
+	std::vector<float> direction_z;
+
+	std::vector<mesh_id> ids;
+	std::vector<float> distances;
+
+	void resize(size_t size)
+	{
+		origin_x.resize(size);
+		origin_y.resize(size);
+		origin_z.resize(size);
+		direction_x.resize(size);
+		direction_y.resize(size);
+		direction_z.resize(size);
+		ids.resize(size);
+		distances.resize(size);
+	}
+
+	size_t size() const
+	{
+		return ids.size();
+	}
+
+	void set(size_t index, const glm::vec3& position, const glm::vec3& direction)
+	{
+		origin_x[index] = position.x;
+		origin_y[index] = position.y;
+		origin_z[index] = position.z;
+		direction_x[index] = direction.x;
+		direction_y[index] = direction.y;
+		direction_z[index] = direction.z;
+	}
+
+	// Overwrites the ray at index to with the one at index from, results included
+	void copy(size_t from, size_t to)
+	{
+		origin_x[to] = origin_x[from];
+		origin_y[to] = origin_y[from];
+		origin_z[to] = origin_z[from];
+		direction_x[to] = direction_x[from];
+		direction_y[to] = direction_y[from];
+		direction_z[to] = direction_z[from];
+		ids[to] = ids[from];
+		distances[to] = distances[from];
+	}
+};
+
+// Trade off between the time spent building the BVH and the speed of the traversal
+enum class build_quality : uint8_t
+{
+	// Morton builder meant for dynamic scenes, the fastest build for previews
+	LOW,
+	// Binned SAH builder
+	MEDIUM,
+	// SAH builder with spatial splits, the fastest traversal for final bakes
+	HIGH
+};
+
+// Number of rays traced together when a stream is split in packets
+enum class packet_width : uint8_t
+{
+	WIDTH_4,
+	WIDTH_8,
+	WIDTH_16
+};
+
+struct scene_options
+{
+	build_quality quality = build_quality::HIGH;
+	// Compressed nodes and triangles, less memory for a slower traversal
+	bool compact = false;
+	// Avoids the optimizations that can let rays slip through shared edges and vertices
+	bool robust = true;
+	packet_width width = packet_width::WIDTH_8;
+};
+
+struct build_stats
+{
+	// Meshes and prototypes, each stored once no matter how many times it is instanced
+	uint32_t geometries = 0;
+	uint32_t instances = 0;
+	size_t triangles = 0;
+	// Time spent in the last commit, which is where the BVH is built
+	float build_milliseconds = .0f;
+	// Bytes currently allocated by Embree for the scene, its geometry and its BVH
+	/* NOTE(Corralx): Embree 2 memory monitors have no user pointer, so the allocations are counted process wide
+	   and attributed to the context doing the call, contexts built concurrently on different threads mix their counts */
+	int64_t memory = 0;
+};
+
 class context
 {
 public:
-	context();
+	explicit context(const scene_options& options = scene_options());
 	~context();
 
 	context(const context&) = delete;
@@ -48,20 +149,75 @@ public:
 	context& operator=(const context&) = delete;
 	context& operator=(context&&) = default;
 
+	// The mesh arrays are used in place, so the mesh has to outlive its geometry in the context
 	mesh_id add_mesh(const mesh_t& mesh);
+
+	// Registers a mesh to be placed any number of times with add_instance(...), it is not traced by itself
+	/* NOTE(Corralx): Each prototype has its own BVH, built once and shared by its instances through a two level BVH
+	   Prototypes live as long as the context, the same lifetime rule of add_mesh(...) applies to the mesh */
+	prototype_id add_prototype(const mesh_t& mesh);
+
+	// Places the prototype with the given object to world transform, hits on the instance report the returned id
+	mesh_id add_instance(prototype_id prototype, const glm::mat4& transform);
+
+	// Removes a mesh or an instance
 	void remove_mesh(mesh_id id);
 
 	bool commit();
 	bool has_error();
 
+	const scene_options& options() const;
+	const build_stats& stats() const;
+
+	// Hash of the geometry of every mesh and instance in the scene, changes whenever one is added or removed
+	// NOTE(Corralx): The meshes are hashed on the first call, not when added, the calls of concurrent bakes are serialized
+	uint64_t content_hash() const;
+
 	intersect_result intersect(const ray& r, float max_distance, float min_distance = .0001f);
 	occluded_result occluded(const ray& r, float max_distance, float min_distance = .0001f);
 
+	// Traces the whole stream with a single call, letting Embree reorder the rays for coherence
+	void intersect(ray_stream& rays, float max_distance, float min_distance = .0001f);
+	void occluded(ray_stream& rays, float max_distance, float min_distance = .0001f);
+
 private:
 	handle_ptr<__RTCDevice> _device;
 	handle_ptr<__RTCScene> _scene;
 
-	std::vector<mesh_id> _geometry;
+	scene_options _options;
+	build_stats _stats;
+
+	// The hashes are computed lazily, adding a mesh only shares its arrays with Embree
+	struct geometry
+	{
+		mesh_id id;
+		// Null for instances, whose hash combines the one of their prototype with their transform
+		const mesh_t* mesh;
+		prototype_id prototype;
+		uint64_t transform_hash;
+		mutable uint64_t hash;
+		mutable bool hashed;
+		size_t triangles;
+		bool instance;
+	};
+
+	struct prototype
+	{
+		handle_ptr<__RTCScene> scene;
+		mesh_id id;
+		const mesh_t* mesh;
+		mutable uint64_t hash;
+		mutable bool hashed;
+		bool committed;
+	};
+
+	uint64_t prototype_hash(const prototype& p) const;
+
+	std::vector<geometry> _geometry;
+	std::vector<prototype> _prototypes;
+
+	// Guards the lazy hashes, held by pointer so the context stays movable
+	std::unique_ptr<std::mutex> _hash_mutex;
 };
 
 }
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+
+#include "image.hpp"
+
+class mesh_t;
+
+// When the future is ready, the image contains the UV triangle indices covering each pixel
+/* NOTE(Corralx): This needs the application window to create its own OpenGL context,
+   use rasterize_triangle_software(...) when running without a display */
+std::future<void> rasterize_triangle_hardware(const mesh_t& mesh, image<pixel_format::U32>& image);
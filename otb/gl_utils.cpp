@@ -0,0 +1,62 @@
+#include "gl_utils.hpp"
+
+#include "elektra/file_io.hpp"
+#include "GL/gl3w.h"
+
+#include <cassert>
+
+// NOTE(Corralx): An OpenGL context must be bound to the current thread for this to work
+elk::optional<uint32_t> load_program(const elk::path& vs_path, const elk::path& fs_path, elk::optional<elk::path> gs_path)
+{
+	auto vs_source = elk::get_content_of_file(vs_path);
+	auto fs_source = elk::get_content_of_file(fs_path);
+	auto gs_source = gs_path ? elk::get_content_of_file(gs_path.value()) : elk::nullopt;
+
+	if (!vs_source || !fs_source)
+		return elk::nullopt;
+
+	uint32_t program = glCreateProgram();
+
+	const char* vs_ptr = vs_source.value().c_str();
+	uint32_t vs = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vs, 1, &vs_ptr, nullptr);
+	glCompileShader(vs);
+	glAttachShader(program, vs);
+
+	const char* fs_ptr = fs_source.value().c_str();
+	uint32_t fs = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fs, 1, &fs_ptr, nullptr);
+	glCompileShader(fs);
+	glAttachShader(program, fs);
+
+	uint32_t gs = 0;
+	if (gs_source)
+	{
+		const char* gs_ptr = gs_source.value().c_str();
+		gs = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(gs, 1, &gs_ptr, nullptr);
+		glCompileShader(gs);
+		glAttachShader(program, gs);
+	}
+
+	glLinkProgram(program);
+
+	glDeleteShader(vs);
+	if (gs != 0)
+		glDeleteShader(gs);
+	glDeleteShader(fs);
+
+	assert(glGetError() == GL_NO_ERROR);
+	return program;
+}
+
+void update_texture_data(material_t mat, const image<pixel_format::F32>& image)
+{
+	int32_t last_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+
+	glBindTexture(GL_TEXTURE_2D, mat.texture_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width(), image.height(), GL_RED, GL_FLOAT, image.raw());
+
+	glBindTexture(GL_TEXTURE_2D, last_texture);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "image.hpp"
+#include "material.hpp"
+
+#include "elektra/optional.hpp"
+#include "elektra/filesystem/path.hpp"
+
+#include <cstdint>
+
+// NOTE(Corralx): Everything in here needs an OpenGL context, so it lives outside of the occlusion library
+
+elk::optional<uint32_t> load_program(const elk::path& vs_path, const elk::path& fs_path,
+									 elk::optional<elk::path> gs_path = elk::nullopt);
+
+void update_texture_data(material_t mat, const image<pixel_format::F32>& image);
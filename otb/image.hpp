@@ -10,7 +10,8 @@ enum class pixel_format : uint8_t
 {
 	U8 = 0,
 	F32 = 1,
-	U32 = 2
+	U32 = 2,
+	U16 = 3
 };
 
 namespace detail
@@ -32,17 +33,18 @@ struct format_to_pixel_info<pixel_format::_value> \
 DECLARE_PIXEL_INFO(U8, uint8_t, 1);
 DECLARE_PIXEL_INFO(F32, float, 1);
 DECLARE_PIXEL_INFO(U32, uint32_t, 1);
+DECLARE_PIXEL_INFO(U16, uint16_t, 1);
 
 #undef DECLARE_PIXEL_INFO
 
 }
 
-#define GET_PIXEL_INFO(info) typename detail::format_to_pixel_info<F>::info
+#define GET_PIXEL_INFO(info) detail::format_to_pixel_info<F>::info
 
 template<pixel_format F>
 class image
 {
-	using Format = GET_PIXEL_INFO(type);
+	using Format = typename GET_PIXEL_INFO(type);
 
 public:
 	image() = delete;
@@ -82,7 +84,7 @@ public:
 		return GET_PIXEL_INFO(size) * _width * _height;
 	}
 
-	const Format* const raw() const
+	const Format* raw() const
 	{
 		return _data.get();
 	}
@@ -25,11 +25,14 @@ chai.eval("helloWorld(\"Bob\");");
 */
 
 #include "utils.hpp"
+#include "gl_utils.hpp"
 #include "image.hpp"
 #include "embree.hpp"
 #include "mesh.hpp"
 #include "occlusion.hpp"
+#include "surface_cache.hpp"
 #include "rasterizer.hpp"
+#include "gl_rasterizer.hpp"
 #include "postprocess.hpp"
 #include "configuration.hpp"
 #include "buffer_manager.hpp"
@@ -199,6 +202,8 @@ int main(int, char*[])
 		std::cerr << "Error initializing Embree!" << std::endl;
 		return 1;
 	}
+	std::cout << "BVH occupies " << context.stats().memory << " bytes!" << std::endl;
+	std::cout << "BVH build has taken " << static_cast<uint32_t>(context.stats().build_milliseconds) << " ms!" << std::endl;
 	
 	std::cout << "Rasterizing UVs..." << std::endl;
 	image<pixel_format::U32> indices_map(MAP_SIZE, MAP_SIZE);
@@ -225,16 +230,24 @@ int main(int, char*[])
 	params.quality = 1;
 	params.worker_num = (uint8_t)elk::number_of_cores();
 
+	// NOTE(Corralx): The surface cache only depends on the mesh and the indices map, keep it around to re-bake with different params
+	surface_cache cache;
 	start_time = hr_clock::now();
-	generate_occlusion_map(context, shapes[mesh_index], params, indices_map, occlusion_map).get();
+	build_surface_cache(shapes[mesh_index], indices_map, params, cache).get();
+	end_time = hr_clock::now();
+	std::cout << "Surface cache occupies " << cache.memory() << " bytes!" << std::endl;
+	std::cout << "Surface cache has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
+
+	start_time = hr_clock::now();
+	generate_occlusion_map(context, cache, params, occlusion_map).get();
 	end_time = hr_clock::now();
 	std::cout << "Occlusion map occupies " << occlusion_map.memory() << " bytes!" << std::endl;
 	std::cout << "Calculation has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
 
 	std::cout << "Postprocessing occlusion map..." << std::endl;
 	start_time = hr_clock::now();
-	gaussian_blur(occlusion_map, 3, 3, 1.f).get();
-	invert(occlusion_map).get();
+	// NOTE(Corralx): The map is mipmapped, pad the islands over the whole map or the seams fade to black
+	postprocess_pipeline().dilate(indices_map).gaussian_blur(3, 3, 1.f).invert().run(occlusion_map).get();
 	end_time = hr_clock::now();
 	std::cout << "Postprocessing has taken " << std::chrono::duration_cast<millis>(end_time - start_time).count() << " ms!" << std::endl;
 
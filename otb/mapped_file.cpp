@@ -0,0 +1,111 @@
+#include "mapped_file.hpp"
+
+#include "elektra/filesystem.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#if defined(_WIN32)
+
+bool mapped_file::open(const elk::path& path)
+{
+	close();
+
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+	{
+		_file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_data == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	_size = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file)
+		CloseHandle(_file);
+
+	_data = nullptr;
+	_size = 0;
+	_mapping = nullptr;
+	_file = nullptr;
+}
+
+#else
+
+bool mapped_file::open(const elk::path& path)
+{
+	close();
+
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// NOTE(Corralx): The mapping keeps the file referenced, so the descriptor can be closed right away
+	void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	_data = static_cast<const uint8_t*>(data);
+	_size = static_cast<size_t>(info.st_size);
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (_data)
+		munmap(const_cast<uint8_t*>(_data), _size);
+
+	_data = nullptr;
+	_size = 0;
+}
+
+#endif
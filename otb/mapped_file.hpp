@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace elk
+{
+class path;
+}
+
+// Read only memory mapping of a whole file, unmapped on destruction
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Returns false if the file does not exist, is empty or cannot be mapped
+	bool open(const elk::path& path);
+	void close();
+
+	const uint8_t* data() const
+	{
+		return _data;
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+
+#if defined(_WIN32)
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
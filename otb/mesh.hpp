@@ -4,15 +4,21 @@
 
 #include "utils.hpp"
 #include "material.hpp"
+#include "array_view.hpp"
+#include "aligned_allocator.hpp"
 
 #include <vector>
 #include <cstdint>
 #include <future>
+#include <memory>
 
 using vertex_t = glm::vec3;
 using normal_t = glm::vec3;
 using texture_coord_t = glm::vec2;
 
+// NOTE(Corralx): Embree reads every vertex with a 16 bytes load, the aligned and padded storage lets it use the vertices in place
+using vertex_buffer = std::vector<vertex_t, aligned_allocator<vertex_t>>;
+
 struct face_t
 {
 	uint32_t v0;
@@ -25,6 +31,8 @@ namespace elk
 class path;
 }
 
+class mapped_file;
+
 // TODO(Corralx): Move bindings to load function and save into mesh
 struct bindings_t
 {
@@ -39,16 +47,26 @@ struct bindings_t
 };
 
 // NOTE(Corralx): This is just a container for the mesh data
+// The arrays are either owned by the mesh or views over a mapped binary mesh file, kept alive by the mesh
+/* The vertices are always 16 bytes aligned and readable with a 16 bytes load at the last vertex, so Embree shares them
+   Owned vertices get it from their allocator, mapped vertices from the alignment of the file and the arrays after them */
 class mesh_t
 {
 public:
 	// TODO(Corralx): Init mesh with all the missing data (material and bindings)
-	mesh_t(std::vector<vertex_t>&& vertices, std::vector<normal_t>&& normals,
+	mesh_t(vertex_buffer&& vertices, std::vector<normal_t>&& normals,
 		   std::vector<texture_coord_t>&& coords, std::vector<face_t>&& faces) :
-		   index(generate_unique_index()), _vertices(vertices), _normals(normals),
-		   _coords(coords), _faces(faces), _material(), _bindings() {}
+		   index(generate_unique_index()), _vertices(std::move(vertices)), _normals(std::move(normals)),
+		   _coords(std::move(coords)), _faces(std::move(faces)), _mapping(), _vertices_view(_vertices),
+		   _normals_view(_normals), _coords_view(_coords), _faces_view(_faces), _material(), _bindings() {}
+
+	mesh_t(std::shared_ptr<const mapped_file> mapping, array_view<const vertex_t> vertices, array_view<const normal_t> normals,
+		   array_view<const texture_coord_t> coords, array_view<const face_t> faces) :
+		   index(generate_unique_index()), _vertices(), _normals(), _coords(), _faces(), _mapping(std::move(mapping)),
+		   _vertices_view(vertices), _normals_view(normals), _coords_view(coords), _faces_view(faces), _material(), _bindings() {}
 
 	mesh_t(const mesh_t&) = delete;
+	// NOTE(Corralx): Moving a vector keeps its buffer, so the views stay valid
 	mesh_t(mesh_t&&) = default;
 	mesh_t& operator=(const mesh_t&) = delete;
 	mesh_t& operator=(mesh_t&&) = default;
@@ -56,32 +74,38 @@ public:
 	// NOTE(Corralx): A mesh releases his buffers but not the associated gl resources
 	~mesh_t() = default;
 
-	const std::vector<vertex_t>& vertices() const
+	array_view<const vertex_t> vertices() const
 	{
-		return _vertices;
+		return _vertices_view;
 	}
 
-	const std::vector<normal_t>& normals() const
+	array_view<const normal_t> normals() const
 	{
-		return _normals;
+		return _normals_view;
 	}
 
-	const std::vector<texture_coord_t>& texture_coords() const
+	array_view<const texture_coord_t> texture_coords() const
 	{
-		return _coords;
+		return _coords_view;
 	}
 
-	const std::vector<face_t>& faces() const
+	array_view<const face_t> faces() const
 	{
-		return _faces;
+		return _faces_view;
 	}
 
-	const size_t memory() const
+	// True if the arrays are views over a mapped file
+	bool is_mapped() const
 	{
-		return	sizeof(vertex_t) * _vertices.size() +
-				sizeof(normal_t) * _normals.size() +
-				sizeof(texture_coord_t) * _coords.size() +
-				sizeof(face_t) * _faces.size();
+		return _mapping != nullptr;
+	}
+
+	size_t memory() const
+	{
+		return	sizeof(vertex_t) * _vertices_view.size() +
+				sizeof(normal_t) * _normals_view.size() +
+				sizeof(texture_coord_t) * _coords_view.size() +
+				sizeof(face_t) * _faces_view.size();
 	}
 
 	material_t& material()
@@ -102,11 +126,17 @@ public:
 	const uint32_t index;
 
 private:
-	std::vector<vertex_t> _vertices;
+	vertex_buffer _vertices;
 	std::vector<normal_t> _normals;
 	std::vector<texture_coord_t> _coords;
 	std::vector<face_t> _faces;
 
+	std::shared_ptr<const mapped_file> _mapping;
+	array_view<const vertex_t> _vertices_view;
+	array_view<const normal_t> _normals_view;
+	array_view<const texture_coord_t> _coords_view;
+	array_view<const face_t> _faces_view;
+
 	material_t _material;
 	bindings_t _bindings;
 };
@@ -0,0 +1,169 @@
+#include "mesh_binary.hpp"
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "utils.hpp"
+
+#include "elektra/filesystem.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+static const uint32_t MESH_MAGIC = 0x4d42544f; // "OTBM"
+static const uint32_t MESH_VERSION = 2;
+static const uint64_t MESH_ALIGNMENT = 16;
+
+// The table hash covers the entries and is always checked, the payload hash covers the arrays following them
+// and is only checked on request, as it touches every page of the mapping
+struct file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t table_hash;
+	uint64_t payload_hash;
+	uint64_t payload_size;
+	uint32_t num_meshes;
+	uint32_t _padding;
+};
+
+// Offsets are relative to the beginning of the file
+struct mesh_entry
+{
+	uint64_t num_vertices;
+	uint64_t num_faces;
+	uint64_t vertices_offset;
+	uint64_t normals_offset;
+	uint64_t coords_offset;
+	uint64_t faces_offset;
+};
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + MESH_ALIGNMENT - 1) & ~(MESH_ALIGNMENT - 1);
+}
+
+bool write_meshes_binary(const elk::path& path, const std::vector<mesh_t>& meshes)
+{
+	// Lay out the file first, the arrays follow the header and the table of entries
+	std::vector<mesh_entry> entries(meshes.size());
+	uint64_t offset = sizeof(file_header) + sizeof(mesh_entry) * entries.size();
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		const mesh_t& mesh = meshes[i];
+		mesh_entry& entry = entries[i];
+
+		// NOTE(Corralx): Loaded meshes always have one normal and one texture coordinate per vertex
+		if (mesh.normals().size() != mesh.vertices().size() || mesh.texture_coords().size() != mesh.vertices().size())
+			return false;
+
+		entry.num_vertices = mesh.vertices().size();
+		entry.num_faces = mesh.faces().size();
+		entry.vertices_offset = align_offset(offset);
+		entry.normals_offset = align_offset(entry.vertices_offset + sizeof(vertex_t) * entry.num_vertices);
+		entry.coords_offset = align_offset(entry.normals_offset + sizeof(normal_t) * entry.num_vertices);
+		entry.faces_offset = align_offset(entry.coords_offset + sizeof(texture_coord_t) * entry.num_vertices);
+		offset = entry.faces_offset + sizeof(face_t) * entry.num_faces;
+	}
+
+	std::vector<uint8_t> data(static_cast<size_t>(offset), 0);
+	memcpy(data.data() + sizeof(file_header), entries.data(), sizeof(mesh_entry) * entries.size());
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		const mesh_t& mesh = meshes[i];
+		const mesh_entry& entry = entries[i];
+
+		memcpy(data.data() + entry.vertices_offset, mesh.vertices().data(), sizeof(vertex_t) * entry.num_vertices);
+		memcpy(data.data() + entry.normals_offset, mesh.normals().data(), sizeof(normal_t) * entry.num_vertices);
+		memcpy(data.data() + entry.coords_offset, mesh.texture_coords().data(), sizeof(texture_coord_t) * entry.num_vertices);
+		memcpy(data.data() + entry.faces_offset, mesh.faces().data(), sizeof(face_t) * entry.num_faces);
+	}
+
+	file_header header{};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	const uint64_t arrays_offset = sizeof(file_header) + sizeof(mesh_entry) * entries.size();
+	header.payload_size = offset - sizeof(file_header);
+	header.table_hash = hash_bytes(data.data() + sizeof(file_header), sizeof(mesh_entry) * entries.size());
+	header.payload_hash = hash_bytes(data.data() + arrays_offset, static_cast<size_t>(offset - arrays_offset));
+	header.num_meshes = static_cast<uint32_t>(meshes.size());
+	memcpy(data.data(), &header, sizeof(header));
+
+	std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	return static_cast<bool>(file);
+}
+
+bool load_meshes_binary(const elk::path& path, std::vector<mesh_t>& meshes, bool verify)
+{
+	auto mapping = std::make_shared<mapped_file>();
+	if (!mapping->open(path) || mapping->size() < sizeof(file_header))
+		return false;
+
+	const uint8_t* data = mapping->data();
+	const uint64_t size = mapping->size();
+
+	file_header header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != MESH_MAGIC || header.version != MESH_VERSION || header.payload_size != size - sizeof(file_header))
+		return false;
+
+	const uint64_t arrays_offset = sizeof(file_header) + sizeof(mesh_entry) * static_cast<uint64_t>(header.num_meshes);
+	if (arrays_offset > size)
+		return false;
+
+	if (hash_bytes(data + sizeof(file_header), static_cast<size_t>(arrays_offset - sizeof(file_header))) != header.table_hash)
+		return false;
+
+	if (verify && hash_bytes(data + arrays_offset, static_cast<size_t>(size - arrays_offset)) != header.payload_hash)
+		return false;
+
+	// Validate the layout of every entry before creating any mesh, so a corrupted table never yields a partial result
+	// NOTE(Corralx): The face indices are only checked against the vertices when verifying, as it reads every face
+	std::vector<mesh_entry> entries(header.num_meshes);
+	memcpy(entries.data(), data + sizeof(file_header), sizeof(mesh_entry) * entries.size());
+	for (const mesh_entry& entry : entries)
+	{
+		auto fits = [size](uint64_t offset, uint64_t bytes)
+		{
+			return offset % MESH_ALIGNMENT == 0 && offset <= size && bytes <= size - offset;
+		};
+
+		if (!fits(entry.vertices_offset, sizeof(vertex_t) * entry.num_vertices) ||
+			!fits(entry.normals_offset, sizeof(normal_t) * entry.num_vertices) ||
+			!fits(entry.coords_offset, sizeof(texture_coord_t) * entry.num_vertices) ||
+			!fits(entry.faces_offset, sizeof(face_t) * entry.num_faces))
+			return false;
+
+		if (!verify)
+			continue;
+
+		const face_t* faces = reinterpret_cast<const face_t*>(data + entry.faces_offset);
+		for (uint64_t i = 0; i < entry.num_faces; ++i)
+		{
+			const face_t& face = faces[i];
+			if (face.v0 >= entry.num_vertices || face.v1 >= entry.num_vertices || face.v2 >= entry.num_vertices)
+				return false;
+		}
+	}
+
+	const std::shared_ptr<const mapped_file> shared_mapping = mapping;
+	for (const mesh_entry& entry : entries)
+	{
+		const size_t num_vertices = static_cast<size_t>(entry.num_vertices);
+		const size_t num_faces = static_cast<size_t>(entry.num_faces);
+
+		mesh_t mesh(shared_mapping,
+					{ reinterpret_cast<const vertex_t*>(data + entry.vertices_offset), num_vertices },
+					{ reinterpret_cast<const normal_t*>(data + entry.normals_offset), num_vertices },
+					{ reinterpret_cast<const texture_coord_t*>(data + entry.coords_offset), num_vertices },
+					{ reinterpret_cast<const face_t*>(data + entry.faces_offset), num_faces });
+
+		material_t& material = mesh.material();
+		material.color = random_color();
+		material.state = material_t::state_t::BASE;
+
+		meshes.push_back(std::move(mesh));
+	}
+
+	return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+class mesh_t;
+
+namespace elk
+{
+class path;
+}
+
+// NOTE(Corralx): Binary mesh format, the arrays are stored as they are in memory and aligned to 16 bytes,
+// so a loaded mesh is a set of views over the mapped file and no parsing or copying is needed
+
+// Writes every mesh into a single binary file, returns false on failure
+bool write_meshes_binary(const elk::path& path, const std::vector<mesh_t>& meshes);
+
+// Maps the file and appends its meshes, returns false if the file is missing, truncated or its table is corrupted
+// The arrays are only read when used, unless verify is set, which hashes them and checks the face indices up front
+// NOTE(Corralx): Verify files coming from untrusted sources, corrupted indices are read out of bounds otherwise
+bool load_meshes_binary(const elk::path& path, std::vector<mesh_t>& meshes, bool verify = false);
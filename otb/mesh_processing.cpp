@@ -0,0 +1,559 @@
+#include "mesh_processing.hpp"
+#include "task_scheduler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+// Below this number of vertices a mesh is welded by a single worker
+static const size_t MIN_PARTITION_VERTICES = 1 << 16;
+
+// Faces are processed in parallel in blocks of this size
+static const size_t MIN_BLOCK_FACES = 1 << 14;
+
+static const uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+
+// A set of floats compared bitwise
+template<size_t N>
+struct float_key
+{
+	float values[N];
+
+	bool operator==(const float_key& other) const
+	{
+		return memcmp(values, other.values, sizeof(values)) == 0;
+	}
+};
+
+// NOTE(Corralx): Adding zero turns -0 into +0, so the two compare equal bitwise
+static float_key<8> vertex_key(const vertex_t& v, const normal_t& n, const texture_coord_t& t)
+{
+	return { { v.x + .0f, v.y + .0f, v.z + .0f, n.x + .0f, n.y + .0f, n.z + .0f, t.x + .0f, t.y + .0f } };
+}
+
+static float_key<3> position_key(const vertex_t& v)
+{
+	return { { v.x + .0f, v.y + .0f, v.z + .0f } };
+}
+
+static float_key<5> surface_key(const vertex_t& v, const texture_coord_t& t)
+{
+	return { { v.x + .0f, v.y + .0f, v.z + .0f, t.x + .0f, t.y + .0f } };
+}
+
+// Maps every item to the first item with an equal key, which maps to itself
+/* NOTE(Corralx): Items with equal keys have the same hash, so they always fall in the same partition
+   The items are bucketed by the high bits of their hash with a counting sort over blocks of items,
+   every partition is then grouped by its own worker with an open addressing table indexed by the low bits */
+template<typename KeyOf>
+static void group_by_key(size_t count, KeyOf key_of, std::vector<uint32_t>& representatives)
+{
+	auto& scheduler = task_scheduler::instance();
+
+	const uint32_t num_partitions = static_cast<uint32_t>(std::max<size_t>(1,
+		std::min<size_t>(scheduler.worker_count(), count / MIN_PARTITION_VERTICES)));
+	const uint32_t num_blocks = num_partitions;
+	const size_t block_size = (count + num_blocks - 1) / num_blocks;
+
+	std::vector<uint64_t> hashes(count);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		const size_t end = std::min(count, (b + 1) * block_size);
+		for (size_t i = b * block_size; i < end; ++i)
+		{
+			const auto key = key_of(i);
+			hashes[i] = hash_bytes(&key, sizeof(key));
+		}
+	});
+
+	auto partition_of = [&](size_t i)
+	{
+		return static_cast<uint32_t>((hashes[i] >> 32) * num_partitions >> 32);
+	};
+
+	// Count the items of each partition in each block
+	std::vector<size_t> counts(static_cast<size_t>(num_blocks) * num_partitions, 0);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		const size_t end = std::min(count, (b + 1) * block_size);
+		for (size_t i = b * block_size; i < end; ++i)
+			++counts[partition_of(i) * num_blocks + b];
+	});
+
+	// Partition major offsets, so the buckets of a partition are laid out in block order
+	std::vector<size_t> offsets(counts.size() + 1, 0);
+	for (size_t i = 0; i < counts.size(); ++i)
+		offsets[i + 1] = offsets[i] + counts[i];
+
+	std::vector<uint32_t> bucketed(count);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		std::vector<size_t> cursor(num_partitions);
+		for (uint32_t p = 0; p < num_partitions; ++p)
+			cursor[p] = offsets[p * num_blocks + b];
+
+		const size_t end = std::min(count, (b + 1) * block_size);
+		for (size_t i = b * block_size; i < end; ++i)
+			bucketed[cursor[partition_of(i)]++] = static_cast<uint32_t>(i);
+	});
+
+	representatives.resize(count);
+	scheduler.parallel_for(num_partitions, [&](uint32_t p)
+	{
+		const size_t begin = offsets[p * num_blocks];
+		const size_t end = offsets[(p + 1) * num_blocks];
+
+		size_t table_size = 16;
+		while (table_size < (end - begin) * 2)
+			table_size <<= 1;
+
+		std::vector<uint32_t> slots(table_size, NO_VERTEX);
+		const size_t mask = table_size - 1;
+
+		for (size_t b = begin; b < end; ++b)
+		{
+			const uint32_t i = bucketed[b];
+			const auto key = key_of(i);
+
+			for (size_t slot = hashes[i] & mask;; slot = (slot + 1) & mask)
+			{
+				if (slots[slot] == NO_VERTEX)
+				{
+					slots[slot] = i;
+					representatives[i] = i;
+					break;
+				}
+
+				if (hashes[slots[slot]] == hashes[i] && key_of(slots[slot]) == key)
+				{
+					representatives[i] = slots[slot];
+					break;
+				}
+			}
+		}
+	});
+}
+
+void weld_vertices(vertex_buffer& vertices, std::vector<normal_t>& normals,
+				   std::vector<texture_coord_t>& coords, std::vector<face_t>& faces)
+{
+	const size_t num_vertices = vertices.size();
+	if (num_vertices == 0)
+		return;
+
+	std::vector<uint32_t> remap;
+	group_by_key(num_vertices, [&](size_t i) { return vertex_key(vertices[i], normals[i], coords[i]); }, remap);
+
+	// The first vertex of every group is moved to its final place, which is never after the current one
+	size_t num_welded = 0;
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		if (remap[i] == i)
+		{
+			vertices[num_welded] = vertices[i];
+			normals[num_welded] = normals[i];
+			coords[num_welded] = coords[i];
+			remap[i] = static_cast<uint32_t>(num_welded++);
+		}
+		else
+			remap[i] = remap[remap[i]];
+	}
+
+	vertices.resize(num_welded);
+	normals.resize(num_welded);
+	coords.resize(num_welded);
+
+	task_scheduler::instance().parallel_for(static_cast<uint32_t>(faces.size() / MIN_BLOCK_FACES + 1), [&](uint32_t b)
+	{
+		const size_t end = std::min(faces.size(), (b + 1) * MIN_BLOCK_FACES);
+		for (size_t f = b * MIN_BLOCK_FACES; f < end; ++f)
+			faces[f] = { remap[faces[f].v0], remap[faces[f].v1], remap[faces[f].v2] };
+	});
+
+	faces.erase(std::remove_if(faces.begin(), faces.end(), [](const face_t& f)
+	{
+		return f.v0 == f.v1 || f.v1 == f.v2 || f.v2 == f.v0;
+	}), faces.end());
+}
+
+// NOTE(Corralx): Tipsify, from "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al. 2007)
+/* Faces are emitted as fans around a fanning vertex, the next one is the vertex of the last fan that stays in the cache
+   and has the most live faces, otherwise the most recent dead end vertex or the next vertex with live faces */
+void optimize_vertex_cache(vertex_buffer& vertices, std::vector<normal_t>& normals,
+						   std::vector<texture_coord_t>& coords, std::vector<face_t>& faces, uint32_t cache_size)
+{
+	const size_t num_vertices = vertices.size();
+	const size_t num_faces = faces.size();
+	if (num_faces == 0)
+		return;
+
+	// Vertex to face adjacency, the live count of a vertex starts as the number of its faces
+	std::vector<uint32_t> live(num_vertices, 0);
+	for (const face_t& f : faces)
+	{
+		++live[f.v0];
+		++live[f.v1];
+		++live[f.v2];
+	}
+
+	std::vector<size_t> adjacency_offsets(num_vertices + 1, 0);
+	for (size_t v = 0; v < num_vertices; ++v)
+		adjacency_offsets[v + 1] = adjacency_offsets[v] + live[v];
+
+	std::vector<uint32_t> adjacency(num_faces * 3);
+	{
+		std::vector<size_t> cursor(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t f = 0; f < num_faces; ++f)
+		{
+			adjacency[cursor[faces[f].v0]++] = static_cast<uint32_t>(f);
+			adjacency[cursor[faces[f].v1]++] = static_cast<uint32_t>(f);
+			adjacency[cursor[faces[f].v2]++] = static_cast<uint32_t>(f);
+		}
+	}
+
+	// A vertex is in the cache if less than cache size vertices entered it after its timestamp
+	std::vector<uint32_t> timestamps(num_vertices, 0);
+	std::vector<uint8_t> emitted(num_faces, 0);
+	std::vector<uint32_t> dead_ends;
+	std::vector<uint32_t> candidates;
+	std::vector<face_t> ordered;
+	ordered.reserve(num_faces);
+
+	uint32_t time = cache_size + 1;
+	size_t cursor = 0;
+
+	auto next_live_vertex = [&]()
+	{
+		while (!dead_ends.empty())
+		{
+			const uint32_t v = dead_ends.back();
+			dead_ends.pop_back();
+			if (live[v] > 0)
+				return v;
+		}
+
+		for (; cursor < num_vertices; ++cursor)
+			if (live[cursor] > 0)
+				return static_cast<uint32_t>(cursor);
+
+		return NO_VERTEX;
+	};
+
+	for (uint32_t fanning = next_live_vertex(); fanning != NO_VERTEX;)
+	{
+		candidates.clear();
+		for (size_t a = adjacency_offsets[fanning]; a < adjacency_offsets[fanning + 1]; ++a)
+		{
+			const uint32_t f = adjacency[a];
+			if (emitted[f])
+				continue;
+
+			emitted[f] = 1;
+			ordered.push_back(faces[f]);
+
+			for (uint32_t v : { faces[f].v0, faces[f].v1, faces[f].v2 })
+			{
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - timestamps[v] > cache_size)
+					timestamps[v] = time++;
+			}
+		}
+
+		// Prefer the oldest candidate that is still going to be in the cache once its live faces are emitted
+		fanning = NO_VERTEX;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+
+			int64_t priority = 0;
+			if (time - timestamps[v] + 2 * live[v] <= cache_size)
+				priority = time - timestamps[v];
+
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				fanning = v;
+			}
+		}
+
+		if (fanning == NO_VERTEX)
+			fanning = next_live_vertex();
+	}
+
+	// Vertices are renumbered in order of first use, so the vertex fetches follow the faces
+	std::vector<uint32_t> remap(num_vertices, NO_VERTEX);
+	uint32_t num_used = 0;
+	for (face_t& f : ordered)
+	{
+		for (uint32_t* v : { &f.v0, &f.v1, &f.v2 })
+		{
+			if (remap[*v] == NO_VERTEX)
+				remap[*v] = num_used++;
+			*v = remap[*v];
+		}
+	}
+
+	vertex_buffer ordered_vertices(num_used);
+	std::vector<normal_t> ordered_normals(num_used);
+	std::vector<texture_coord_t> ordered_coords(num_used);
+	for (size_t v = 0; v < num_vertices; ++v)
+	{
+		if (remap[v] != NO_VERTEX)
+		{
+			ordered_vertices[remap[v]] = vertices[v];
+			ordered_normals[remap[v]] = normals[v];
+			ordered_coords[remap[v]] = coords[v];
+		}
+	}
+
+	vertices.swap(ordered_vertices);
+	normals.swap(ordered_normals);
+	coords.swap(ordered_coords);
+	faces.swap(ordered);
+}
+
+// NOTE(Corralx): Two block pass exclusive prefix sum, each block sums its range and is then offset by the blocks before
+static void parallel_exclusive_scan(std::vector<uint32_t>& values)
+{
+	auto& scheduler = task_scheduler::instance();
+	const size_t count = values.size();
+	const uint32_t num_blocks = static_cast<uint32_t>(count / MIN_PARTITION_VERTICES + 1);
+
+	std::vector<uint32_t> block_sums(num_blocks + 1, 0);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		const size_t end = std::min(count, (b + 1) * MIN_PARTITION_VERTICES);
+		uint32_t sum = 0;
+		for (size_t i = b * MIN_PARTITION_VERTICES; i < end; ++i)
+		{
+			const uint32_t v = values[i];
+			values[i] = sum;
+			sum += v;
+		}
+		block_sums[b + 1] = sum;
+	});
+
+	for (uint32_t b = 0; b < num_blocks; ++b)
+		block_sums[b + 1] += block_sums[b];
+
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		const size_t end = std::min(count, (b + 1) * MIN_PARTITION_VERTICES);
+		for (size_t i = b * MIN_PARTITION_VERTICES; i < end; ++i)
+			values[i] += block_sums[b];
+	});
+}
+
+static float corner_angle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	const glm::vec3 e0 = b - a;
+	const glm::vec3 e1 = c - a;
+	const float length = glm::length(e0) * glm::length(e1);
+	if (length == .0f)
+		return .0f;
+	return std::acos(glm::clamp(glm::dot(e0, e1) / length, -1.f, 1.f));
+}
+
+// Vertices without any weighted face around them get an arbitrary normal
+static glm::vec3 safe_normalize(const glm::vec3& n)
+{
+	const float length = glm::length(n);
+	return length > .0f ? n / length : glm::vec3(.0f, .0f, 1.f);
+}
+
+/* NOTE(Corralx): Vertices sharing a position are grouped first, so UV seams do not show in the normals
+   Each position gets the list of its face corners through a counting sort over the positions, every normal
+   is then gathered from the list with no concurrent writes, and the lists are sorted to keep the result deterministic */
+void generate_normals(vertex_buffer& vertices, std::vector<normal_t>& normals,
+					  std::vector<texture_coord_t>& coords, std::vector<face_t>& faces, float crease_angle)
+{
+	auto& scheduler = task_scheduler::instance();
+
+	const size_t num_vertices = vertices.size();
+	const size_t num_faces = faces.size();
+	normals.assign(num_vertices, normal_t(.0f));
+	if (num_faces == 0)
+		return;
+
+	// Every vertex is mapped to the first vertex at the same position
+	std::vector<uint32_t> positions;
+	group_by_key(num_vertices, [&](size_t i) { return position_key(vertices[i]); }, positions);
+
+	const uint32_t num_face_blocks = static_cast<uint32_t>(num_faces / MIN_BLOCK_FACES + 1);
+	auto for_each_face = [&](auto f)
+	{
+		scheduler.parallel_for(num_face_blocks, [&](uint32_t b)
+		{
+			const size_t end = std::min(num_faces, (b + 1) * MIN_BLOCK_FACES);
+			for (size_t i = b * MIN_BLOCK_FACES; i < end; ++i)
+				f(i);
+		});
+	};
+
+	// The cross product is twice the face area, scaled by the angle it makes the weight of each corner
+	std::vector<glm::vec3> weighted(num_faces * 3);
+	std::vector<glm::vec3> face_normals(num_faces);
+	std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[num_vertices + 1]);
+	for (size_t v = 0; v <= num_vertices; ++v)
+		counts[v].store(0, std::memory_order_relaxed);
+
+	for_each_face([&](size_t f)
+	{
+		const uint32_t* indices = &faces[f].v0;
+		const glm::vec3& a = vertices[indices[0]];
+		const glm::vec3& b = vertices[indices[1]];
+		const glm::vec3& c = vertices[indices[2]];
+
+		const glm::vec3 n = glm::cross(b - a, c - a);
+		face_normals[f] = safe_normalize(n);
+		weighted[f * 3] = n * corner_angle(a, b, c);
+		weighted[f * 3 + 1] = n * corner_angle(b, c, a);
+		weighted[f * 3 + 2] = n * corner_angle(c, a, b);
+
+		for (uint32_t k = 0; k < 3; ++k)
+			counts[positions[indices[k]]].fetch_add(1, std::memory_order_relaxed);
+	});
+
+	std::vector<uint32_t> offsets(num_vertices + 1);
+	for (size_t v = 0; v <= num_vertices; ++v)
+		offsets[v] = counts[v].load(std::memory_order_relaxed);
+	parallel_exclusive_scan(offsets);
+
+	for (size_t v = 0; v <= num_vertices; ++v)
+		counts[v].store(offsets[v], std::memory_order_relaxed);
+
+	std::vector<uint32_t> adjacency(num_faces * 3);
+	for_each_face([&](size_t f)
+	{
+		const uint32_t* indices = &faces[f].v0;
+		for (uint32_t k = 0; k < 3; ++k)
+			adjacency[counts[positions[indices[k]]].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(f * 3 + k);
+	});
+	counts.reset();
+
+	const uint32_t num_vertex_blocks = static_cast<uint32_t>(num_vertices / MIN_PARTITION_VERTICES + 1);
+	scheduler.parallel_for(num_vertex_blocks, [&](uint32_t b)
+	{
+		const size_t end = std::min(num_vertices, (b + 1) * MIN_PARTITION_VERTICES);
+		for (size_t v = b * MIN_PARTITION_VERTICES; v < end; ++v)
+			std::sort(adjacency.begin() + offsets[v], adjacency.begin() + offsets[v + 1]);
+	});
+
+	// Without creases every corner of a position shares the same normal, so there is one gather per position
+	if (crease_angle >= glm::pi<float>())
+	{
+		scheduler.parallel_for(num_vertex_blocks, [&](uint32_t b)
+		{
+			const size_t end = std::min(num_vertices, (b + 1) * MIN_PARTITION_VERTICES);
+			for (size_t v = b * MIN_PARTITION_VERTICES; v < end; ++v)
+			{
+				if (positions[v] != v)
+					continue;
+
+				glm::vec3 n(.0f);
+				for (uint32_t a = offsets[v]; a < offsets[v + 1]; ++a)
+					n += weighted[adjacency[a]];
+				normals[v] = safe_normalize(n);
+			}
+		});
+
+		scheduler.parallel_for(num_vertex_blocks, [&](uint32_t b)
+		{
+			const size_t end = std::min(num_vertices, (b + 1) * MIN_PARTITION_VERTICES);
+			for (size_t v = b * MIN_PARTITION_VERTICES; v < end; ++v)
+				if (positions[v] != v)
+					normals[v] = normals[positions[v]];
+		});
+		return;
+	}
+
+	// Every corner only gathers the faces around its position within the crease angle from its own face
+	const float crease_cosine = std::cos(crease_angle);
+	std::vector<normal_t> corner_normals(num_faces * 3);
+	for_each_face([&](size_t f)
+	{
+		const uint32_t* indices = &faces[f].v0;
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			const uint32_t p = positions[indices[k]];
+			glm::vec3 n(.0f);
+			for (uint32_t a = offsets[p]; a < offsets[p + 1]; ++a)
+				if (glm::dot(face_normals[adjacency[a] / 3], face_normals[f]) >= crease_cosine)
+					n += weighted[adjacency[a]];
+			corner_normals[f * 3 + k] = safe_normalize(n);
+		}
+	});
+
+	// Corners of a vertex on a crease get different normals, so the vertices are split per corner and welded back
+	vertex_buffer corner_vertices(num_faces * 3);
+	std::vector<texture_coord_t> corner_coords(num_faces * 3);
+	for_each_face([&](size_t f)
+	{
+		const uint32_t* indices = &faces[f].v0;
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			corner_vertices[f * 3 + k] = vertices[indices[k]];
+			corner_coords[f * 3 + k] = coords[indices[k]];
+		}
+
+		const uint32_t first = static_cast<uint32_t>(f * 3);
+		faces[f] = { first, first + 1, first + 2 };
+	});
+
+	vertices.swap(corner_vertices);
+	normals.swap(corner_normals);
+	coords.swap(corner_coords);
+	weld_vertices(vertices, normals, coords, faces);
+}
+
+uint32_t find_uv_islands(const mesh_t& mesh, std::vector<uint32_t>& face_islands)
+{
+	const auto vertices = mesh.vertices();
+	const auto coords = mesh.texture_coords();
+	const auto faces = mesh.faces();
+
+	// Every vertex is mapped to the first vertex at the same point of the UV unwrap
+	std::vector<uint32_t> parents;
+	group_by_key(vertices.size(), [&](size_t i) { return surface_key(vertices[i], coords[i]); }, parents);
+
+	// NOTE(Corralx): Union find over the vertices, with path halving, the faces join the sets of their corners
+	auto find = [&](uint32_t v)
+	{
+		while (parents[v] != v)
+		{
+			parents[v] = parents[parents[v]];
+			v = parents[v];
+		}
+		return v;
+	};
+
+	for (const face_t& f : faces)
+	{
+		const uint32_t a = find(f.v0);
+		const uint32_t b = find(f.v1);
+		const uint32_t c = find(f.v2);
+		parents[b] = a;
+		parents[c] = a;
+	}
+
+	std::vector<uint32_t> labels(vertices.size(), NO_VERTEX);
+	uint32_t num_islands = 0;
+	face_islands.resize(faces.size());
+	for (size_t i = 0; i < faces.size(); ++i)
+	{
+		const uint32_t root = find(faces[i].v0);
+		if (labels[root] == NO_VERTEX)
+			labels[root] = num_islands++;
+		face_islands[i] = labels[root];
+	}
+
+	return num_islands;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "glm/gtc/constants.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// NOTE(Corralx): Load time processing of the mesh arrays, run before the mesh is built so the buffers
+// uploaded to Embree and OpenGL are already compact and cache friendly
+
+// Typical post transform cache size of the hardware we target, larger caches still benefit from the ordering
+static const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Normals generated with this crease angle are smooth everywhere
+static const float DEFAULT_CREASE_ANGLE = glm::pi<float>();
+
+// Merges the vertices with the same position, normal and texture coordinate, remapping the faces
+// Faces left with two equal indices are dropped, since they no longer cover any area
+void weld_vertices(vertex_buffer& vertices, std::vector<normal_t>& normals,
+				   std::vector<texture_coord_t>& coords, std::vector<face_t>& faces);
+
+// Computes smooth vertex normals weighted by the area and the angle of the faces around each position
+// Faces further than the crease angle from a face do not contribute to its corners, splitting the vertices on the creases
+void generate_normals(vertex_buffer& vertices, std::vector<normal_t>& normals,
+					  std::vector<texture_coord_t>& coords, std::vector<face_t>& faces,
+					  float crease_angle = DEFAULT_CREASE_ANGLE);
+
+// Reorders the faces for the post transform vertex cache (Tipsify) and then the vertices in order of first use
+// Vertices not referenced by any face are dropped
+void optimize_vertex_cache(vertex_buffer& vertices, std::vector<normal_t>& normals,
+						   std::vector<texture_coord_t>& coords, std::vector<face_t>& faces,
+						   uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+// Labels every face with the UV island it belongs to and returns the number of islands
+// Faces sharing a corner with the same position and texture coordinate are in the same island, whatever the normals
+uint32_t find_uv_islands(const mesh_t& mesh, std::vector<uint32_t>& face_islands);
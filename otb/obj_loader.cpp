@@ -0,0 +1,624 @@
+#include "obj_loader.hpp"
+#include "mesh.hpp"
+#include "mapped_file.hpp"
+#include "mesh_processing.hpp"
+#include "task_scheduler.hpp"
+#include "utils.hpp"
+
+#include "elektra/filesystem.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// NOTE(Corralx): Chunks smaller than this are not worth a task
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+// Below this number of corners a shape is deduplicated by a single worker
+static const size_t MIN_PARTITION_CORNERS = 1 << 16;
+
+// NOTE(Corralx): The vertices come out in partition order, so the partitions depend only on the shape and never on the
+// number of workers, otherwise the same file would load into different arrays (and bake cache keys) on different machines
+static const size_t MAX_PARTITIONS = 64;
+
+static const int32_t NO_INDEX = -1;
+
+enum attribute : uint8_t
+{
+	POSITION = 1,
+	COORD = 2,
+	NORMAL = 4
+};
+
+// Zero based indices of the attributes of a triangle corner, NO_INDEX when missing
+struct corner_t
+{
+	int32_t v;
+	int32_t vt;
+	int32_t vn;
+};
+
+// A corner whose relative indices are resolved against the chunk, the counts of the previous chunks are added later
+struct relative_corner
+{
+	size_t corner;
+	uint8_t attributes;
+};
+
+struct chunk_t
+{
+	const char* begin;
+	const char* end;
+
+	std::vector<vertex_t> positions;
+	std::vector<normal_t> normals;
+	std::vector<texture_coord_t> coords;
+
+	std::vector<corner_t> corners;
+	std::vector<relative_corner> relative_corners;
+
+	// The triangles, local to the chunk, where an 'o', 'g' or 'usemtl' statement starts a new shape
+	std::vector<size_t> shape_breaks;
+};
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool is_digit(char c)
+{
+	return static_cast<unsigned>(c - '0') < 10u;
+}
+
+static const char* skip_spaces(const char* p, const char* end)
+{
+	while (p < end && is_space(*p))
+		++p;
+	return p;
+}
+
+static const char* skip_token(const char* p, const char* end)
+{
+	while (p < end && !is_space(*p))
+		++p;
+	return p;
+}
+
+// The keyword ends at a space or at the end of the line, bare "g" and "o" statements reset the group
+static bool starts_with(const char* p, const char* end, const char* keyword)
+{
+	const size_t length = strlen(keyword);
+	return static_cast<size_t>(end - p) >= length && memcmp(p, keyword, length) == 0 && (p + length == end || is_space(p[length]));
+}
+
+// NOTE(Corralx): Accumulates up to 19 significant digits in an integer and scales it once by a power of ten,
+// exact powers up to 1e22 cover every value written by common exporters
+static const double POWERS_OF_TEN[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char* parse_float(const char* p, const char* end, float& value)
+{
+	p = skip_spaces(p, end);
+	const char* start = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int32_t exponent = 0;
+	int32_t digits = 0;
+	bool any_digit = false;
+
+	for (; p < end && is_digit(*p); ++p)
+	{
+		any_digit = true;
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			++exponent;
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && is_digit(*p); ++p)
+		{
+			any_digit = true;
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+				digits += mantissa != 0;
+				--exponent;
+			}
+		}
+	}
+
+	// Anything unusual (nan, inf, hex floats) goes through the standard library
+	if (!any_digit)
+	{
+		char buffer[64] = {};
+		const size_t length = std::min<size_t>(skip_token(start, end) - start, sizeof(buffer) - 1);
+		memcpy(buffer, start, length);
+		value = strtof(buffer, nullptr);
+		return skip_token(start, end);
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative_exponent = *p++ == '-';
+
+		int32_t explicit_exponent = 0;
+		for (; p < end && is_digit(*p); ++p)
+			if (explicit_exponent < 10000)
+				explicit_exponent = explicit_exponent * 10 + (*p - '0');
+
+		exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+	}
+
+	double result = static_cast<double>(mantissa);
+	if (exponent >= 0 && exponent <= 22)
+		result *= POWERS_OF_TEN[exponent];
+	else if (exponent < 0 && exponent >= -22)
+		result /= POWERS_OF_TEN[-exponent];
+	else
+		result *= std::pow(10.0, exponent);
+
+	value = static_cast<float>(negative ? -result : result);
+	return skip_token(p, end);
+}
+
+// Missing digits parse as zero, like atoi does
+static const char* parse_int(const char* p, const char* end, int32_t& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	int64_t result = 0;
+	for (; p < end && is_digit(*p); ++p)
+		if (result <= std::numeric_limits<int32_t>::max())
+			result = result * 10 + (*p - '0');
+
+	result = std::min<int64_t>(result, std::numeric_limits<int32_t>::max());
+	value = static_cast<int32_t>(negative ? -result : result);
+	return p;
+}
+
+// Makes the index zero based, negative indices are relative to the attributes read so far in the chunk
+static int32_t fix_index(int32_t index, size_t count, uint8_t attribute, uint8_t& relative_attributes)
+{
+	if (index > 0)
+		return index - 1;
+	if (index == 0)
+		return 0;
+
+	relative_attributes |= attribute;
+	return static_cast<int32_t>(count) + index;
+}
+
+static void parse_face(const char* p, const char* end, chunk_t& chunk, std::vector<std::pair<corner_t, uint8_t>>& polygon)
+{
+	polygon.clear();
+
+	// Every vertex is one of i, i/j, i//k or i/j/k
+	for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end))
+	{
+		corner_t corner{ NO_INDEX, NO_INDEX, NO_INDEX };
+		uint8_t relative_attributes = 0;
+		int32_t index;
+
+		p = parse_int(p, end, index);
+		corner.v = fix_index(index, chunk.positions.size(), POSITION, relative_attributes);
+
+		if (p < end && *p == '/')
+		{
+			++p;
+			if (p < end && *p != '/')
+			{
+				p = parse_int(p, end, index);
+				corner.vt = fix_index(index, chunk.coords.size(), COORD, relative_attributes);
+			}
+
+			if (p < end && *p == '/')
+			{
+				p = parse_int(p + 1, end, index);
+				corner.vn = fix_index(index, chunk.normals.size(), NORMAL, relative_attributes);
+			}
+		}
+
+		polygon.emplace_back(corner, relative_attributes);
+		p = skip_token(p, end);
+	}
+
+	// Triangle fan, as every exporter expects for convex polygons
+	for (size_t k = 2; k < polygon.size(); ++k)
+	{
+		for (size_t c : { size_t(0), k - 1, k })
+		{
+			if (polygon[c].second != 0)
+				chunk.relative_corners.push_back({ chunk.corners.size(), polygon[c].second });
+			chunk.corners.push_back(polygon[c].first);
+		}
+	}
+}
+
+static void parse_chunk(chunk_t& chunk)
+{
+	std::vector<std::pair<corner_t, uint8_t>> polygon;
+
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* line_end = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		const char* next_line = line_end ? line_end + 1 : chunk.end;
+		if (!line_end)
+			line_end = chunk.end;
+		if (line_end > p && line_end[-1] == '\r')
+			--line_end;
+
+		p = skip_spaces(p, line_end);
+		if (p < line_end)
+		{
+			if (starts_with(p, line_end, "v"))
+			{
+				glm::vec3 v(.0f);
+				const char* token = parse_float(skip_token(p, line_end), line_end, v.x);
+				token = parse_float(token, line_end, v.y);
+				parse_float(token, line_end, v.z);
+				chunk.positions.push_back(v);
+			}
+			else if (starts_with(p, line_end, "vn"))
+			{
+				glm::vec3 n(.0f);
+				const char* token = parse_float(skip_token(p, line_end), line_end, n.x);
+				token = parse_float(token, line_end, n.y);
+				parse_float(token, line_end, n.z);
+				chunk.normals.push_back(n);
+			}
+			else if (starts_with(p, line_end, "vt"))
+			{
+				glm::vec2 t(.0f);
+				const char* token = parse_float(skip_token(p, line_end), line_end, t.x);
+				parse_float(token, line_end, t.y);
+				chunk.coords.push_back(t);
+			}
+			else if (starts_with(p, line_end, "f"))
+				parse_face(skip_token(p, line_end), line_end, chunk, polygon);
+			else if (starts_with(p, line_end, "o") || starts_with(p, line_end, "g") || starts_with(p, line_end, "usemtl"))
+				chunk.shape_breaks.push_back(chunk.corners.size() / 3);
+
+			// Comments and every other statement are ignored
+		}
+
+		p = next_line;
+	}
+}
+
+// The normal can be missing, in which case the normals of the shape are generated
+static bool valid_corner(const corner_t& c, size_t num_positions, size_t num_coords, size_t num_normals)
+{
+	return c.v >= 0 && static_cast<size_t>(c.v) < num_positions &&
+		   c.vt >= 0 && static_cast<size_t>(c.vt) < num_coords &&
+		   (c.vn == NO_INDEX || (c.vn >= 0 && static_cast<size_t>(c.vn) < num_normals));
+}
+
+static uint32_t hash_corner(const corner_t& c)
+{
+	uint32_t h = static_cast<uint32_t>(c.v) * 0x9e3779b1u;
+	h ^= static_cast<uint32_t>(c.vt) * 0x85ebca77u;
+	h ^= static_cast<uint32_t>(c.vn) * 0xc2b2ae3du;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+// Open addressing table of the distinct corners of a partition, in order of first appearance
+class corner_table
+{
+public:
+	explicit corner_table(size_t expected) : _slots(next_power_of_two(std::max<size_t>(16, expected * 2)), 0) {}
+
+	// Returns the index of the corner, adding it if needed
+	uint32_t insert(const corner_t& c)
+	{
+		if ((_corners.size() + 1) * 2 > _slots.size())
+			grow();
+
+		const size_t mask = _slots.size() - 1;
+		for (size_t slot = hash_corner(c) & mask;; slot = (slot + 1) & mask)
+		{
+			if (_slots[slot] == 0)
+			{
+				_corners.push_back(c);
+				_slots[slot] = static_cast<uint32_t>(_corners.size());
+				return _slots[slot] - 1;
+			}
+
+			const corner_t& other = _corners[_slots[slot] - 1];
+			if (other.v == c.v && other.vt == c.vt && other.vn == c.vn)
+				return _slots[slot] - 1;
+		}
+	}
+
+	const std::vector<corner_t>& corners() const
+	{
+		return _corners;
+	}
+
+private:
+	static size_t next_power_of_two(size_t v)
+	{
+		size_t p = 1;
+		while (p < v)
+			p <<= 1;
+		return p;
+	}
+
+	void grow()
+	{
+		std::vector<uint32_t> slots(_slots.size() * 2, 0);
+		const size_t mask = slots.size() - 1;
+		for (uint32_t i = 0; i < _corners.size(); ++i)
+		{
+			size_t slot = hash_corner(_corners[i]) & mask;
+			while (slots[slot] != 0)
+				slot = (slot + 1) & mask;
+			slots[slot] = i + 1;
+		}
+		_slots.swap(slots);
+	}
+
+	std::vector<uint32_t> _slots;
+	std::vector<corner_t> _corners;
+};
+
+// NOTE(Corralx): The corners are split by position index in contiguous ranges, each deduplicated by its own worker
+// Bucketing goes through a counting sort over blocks of triangles, so every partition keeps the order of first appearance
+static bool build_shape(std::vector<corner_t>& corners, size_t first_triangle, size_t last_triangle,
+						const std::vector<vertex_t>& positions, const std::vector<normal_t>& normals,
+						const std::vector<texture_coord_t>& coords, std::vector<mesh_t>& meshes)
+{
+	auto& scheduler = task_scheduler::instance();
+
+	const size_t first_corner = first_triangle * 3;
+	const size_t num_corners = (last_triangle - first_triangle) * 3;
+
+	// Shapes referencing missing attributes are skipped as a whole
+	bool missing_normals = false;
+	for (size_t c = first_corner; c < first_corner + num_corners; ++c)
+	{
+		if (!valid_corner(corners[c], positions.size(), coords.size(), normals.size()))
+			return false;
+		missing_normals |= corners[c].vn == NO_INDEX;
+	}
+
+	// If any corner has no normal, the normals of the whole shape are generated and the given ones ignored
+	if (missing_normals)
+		for (size_t c = first_corner; c < first_corner + num_corners; ++c)
+			corners[c].vn = NO_INDEX;
+
+	const uint32_t num_partitions = static_cast<uint32_t>(std::max<size_t>(1,
+		std::min<size_t>(MAX_PARTITIONS, num_corners / MIN_PARTITION_CORNERS)));
+	const uint32_t num_blocks = num_partitions;
+	const size_t block_size = (num_corners + num_blocks - 1) / num_blocks;
+
+	auto partition_of = [&](const corner_t& c)
+	{
+		return static_cast<uint32_t>(static_cast<uint64_t>(c.v) * num_partitions / positions.size());
+	};
+
+	// Count the corners of each partition in each block
+	std::vector<size_t> counts(static_cast<size_t>(num_blocks) * num_partitions, 0);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		const size_t begin = first_corner + b * block_size;
+		const size_t end = std::min(begin + block_size, first_corner + num_corners);
+		for (size_t c = begin; c < end; ++c)
+			++counts[partition_of(corners[c]) * num_blocks + b];
+	});
+
+	// Partition major offsets, so the buckets of a partition are laid out in block order
+	std::vector<size_t> offsets(counts.size() + 1, 0);
+	for (size_t i = 0; i < counts.size(); ++i)
+		offsets[i + 1] = offsets[i] + counts[i];
+
+	std::vector<uint32_t> bucketed(num_corners);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		std::vector<size_t> cursor(num_partitions);
+		for (uint32_t p = 0; p < num_partitions; ++p)
+			cursor[p] = offsets[p * num_blocks + b];
+
+		const size_t begin = first_corner + b * block_size;
+		const size_t end = std::min(begin + block_size, first_corner + num_corners);
+		for (size_t c = begin; c < end; ++c)
+			bucketed[cursor[partition_of(corners[c])]++] = static_cast<uint32_t>(c - first_corner);
+	});
+
+	// Deduplicate every partition, remembering the local vertex of each corner
+	std::vector<uint32_t> corner_vertex(num_corners);
+	std::vector<std::vector<corner_t>> partition_vertices(num_partitions);
+	scheduler.parallel_for(num_partitions, [&](uint32_t p)
+	{
+		const size_t begin = offsets[p * num_blocks];
+		const size_t end = offsets[(p + 1) * num_blocks];
+
+		corner_table table(end - begin);
+		for (size_t i = begin; i < end; ++i)
+			corner_vertex[bucketed[i]] = table.insert(corners[first_corner + bucketed[i]]);
+
+		partition_vertices[p] = table.corners();
+	});
+
+	std::vector<size_t> vertex_offsets(num_partitions + 1, 0);
+	for (uint32_t p = 0; p < num_partitions; ++p)
+		vertex_offsets[p + 1] = vertex_offsets[p] + partition_vertices[p].size();
+
+	const size_t num_vertices = vertex_offsets[num_partitions];
+	if (num_vertices > std::numeric_limits<uint32_t>::max())
+		return false;
+
+	vertex_buffer mesh_vertices(num_vertices);
+	std::vector<normal_t> mesh_normals(num_vertices);
+	std::vector<texture_coord_t> mesh_coords(num_vertices);
+	scheduler.parallel_for(num_partitions, [&](uint32_t p)
+	{
+		const auto& vertices = partition_vertices[p];
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			mesh_vertices[vertex_offsets[p] + i] = positions[vertices[i].v];
+			mesh_normals[vertex_offsets[p] + i] = vertices[i].vn != NO_INDEX ? normals[vertices[i].vn] : normal_t(.0f);
+			mesh_coords[vertex_offsets[p] + i] = coords[vertices[i].vt];
+		}
+	});
+
+	std::vector<face_t> mesh_faces(num_corners / 3);
+	scheduler.parallel_for(num_blocks, [&](uint32_t b)
+	{
+		auto vertex_index = [&](size_t c)
+		{
+			return static_cast<uint32_t>(vertex_offsets[partition_of(corners[first_corner + c])] + corner_vertex[c]);
+		};
+
+		const size_t begin = (b * block_size) / 3;
+		const size_t end = std::min((b + 1) * block_size, num_corners) / 3;
+		for (size_t f = begin; f < end; ++f)
+			mesh_faces[f] = { vertex_index(f * 3), vertex_index(f * 3 + 1), vertex_index(f * 3 + 2) };
+	});
+
+	// Index triples with equal values are merged too, then the faces are sorted for the vertex cache
+	if (missing_normals)
+		generate_normals(mesh_vertices, mesh_normals, mesh_coords, mesh_faces);
+	weld_vertices(mesh_vertices, mesh_normals, mesh_coords, mesh_faces);
+	optimize_vertex_cache(mesh_vertices, mesh_normals, mesh_coords, mesh_faces);
+	if (mesh_faces.empty())
+		return false;
+
+	mesh_t mesh(std::move(mesh_vertices), std::move(mesh_normals), std::move(mesh_coords), std::move(mesh_faces));
+
+	material_t& material = mesh.material();
+	material.color = random_color();
+	material.state = material_t::state_t::BASE;
+
+	meshes.push_back(std::move(mesh));
+	return true;
+}
+
+// Concatenates the arrays of every chunk, releasing each chunk array as soon as it is copied
+template<typename T, typename Member>
+static std::vector<T> concatenate(std::vector<chunk_t>& chunks, Member member, std::vector<size_t>& offsets)
+{
+	offsets.assign(chunks.size() + 1, 0);
+	for (size_t c = 0; c < chunks.size(); ++c)
+		offsets[c + 1] = offsets[c] + (chunks[c].*member).size();
+
+	std::vector<T> result(offsets.back());
+	task_scheduler::instance().parallel_for(static_cast<uint32_t>(chunks.size()), [&](uint32_t c)
+	{
+		auto& source = chunks[c].*member;
+		std::copy(source.begin(), source.end(), result.begin() + offsets[c]);
+		std::vector<T>().swap(source);
+	});
+
+	return result;
+}
+
+bool load_obj(const elk::path& path, std::vector<mesh_t>& meshes)
+{
+	mapped_file file;
+	if (!file.open(path))
+		return false;
+
+	auto& scheduler = task_scheduler::instance();
+
+	const char* data = reinterpret_cast<const char*>(file.data());
+	const size_t size = file.size();
+
+	// Split the file in a few chunks per worker, moving every split after the next line break
+	const size_t num_splits = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_SIZE, scheduler.worker_count() * 4));
+	std::vector<chunk_t> chunks;
+	chunks.reserve(num_splits);
+
+	const char* begin = data;
+	for (size_t s = 1; s <= num_splits && begin < data + size; ++s)
+	{
+		const char* end = data + size * s / num_splits;
+		if (end < begin)
+			end = begin;
+
+		if (s < num_splits)
+		{
+			const char* line_break = static_cast<const char*>(memchr(end, '\n', data + size - end));
+			end = line_break ? line_break + 1 : data + size;
+		}
+
+		chunks.emplace_back();
+		chunks.back().begin = begin;
+		chunks.back().end = end;
+		begin = end;
+	}
+
+	scheduler.parallel_for(static_cast<uint32_t>(chunks.size()), [&](uint32_t c)
+	{
+		parse_chunk(chunks[c]);
+	});
+
+	std::vector<size_t> position_offsets;
+	std::vector<size_t> normal_offsets;
+	std::vector<size_t> coord_offsets;
+	std::vector<size_t> corner_offsets;
+	const std::vector<vertex_t> positions = concatenate<vertex_t>(chunks, &chunk_t::positions, position_offsets);
+	const std::vector<normal_t> normals = concatenate<normal_t>(chunks, &chunk_t::normals, normal_offsets);
+	const std::vector<texture_coord_t> coords = concatenate<texture_coord_t>(chunks, &chunk_t::coords, coord_offsets);
+
+	// Relative indices can only be resolved once the attributes of the previous chunks are known
+	scheduler.parallel_for(static_cast<uint32_t>(chunks.size()), [&](uint32_t c)
+	{
+		for (const relative_corner& relative : chunks[c].relative_corners)
+		{
+			corner_t& corner = chunks[c].corners[relative.corner];
+			if (relative.attributes & POSITION)
+				corner.v += static_cast<int32_t>(position_offsets[c]);
+			if (relative.attributes & COORD)
+				corner.vt += static_cast<int32_t>(coord_offsets[c]);
+			if (relative.attributes & NORMAL)
+				corner.vn += static_cast<int32_t>(normal_offsets[c]);
+		}
+	});
+
+	std::vector<corner_t> corners = concatenate<corner_t>(chunks, &chunk_t::corners, corner_offsets);
+
+	// Shapes are the non empty runs of triangles between two breaks
+	std::vector<size_t> breaks;
+	for (size_t c = 0; c < chunks.size(); ++c)
+		for (size_t b : chunks[c].shape_breaks)
+			breaks.push_back(corner_offsets[c] / 3 + b);
+	breaks.push_back(corners.size() / 3);
+
+	chunks.clear();
+	file.close();
+
+	size_t first_triangle = 0;
+	for (size_t last_triangle : breaks)
+	{
+		if (last_triangle > first_triangle)
+			build_shape(corners, first_triangle, last_triangle, positions, normals, coords, meshes);
+		first_triangle = last_triangle;
+	}
+
+	return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+class mesh_t;
+
+namespace elk
+{
+class path;
+}
+
+// NOTE(Corralx): Parallel Wavefront OBJ loader, the file is mapped and split in chunks at line boundaries,
+// the chunks are parsed concurrently and then stitched back together in shapes
+/* The shapes are split on every 'o', 'g' and 'usemtl' statement and every distinct position, texture coordinate and normal
+   triple becomes a vertex, polygons are triangulated as fans. Shapes missing texture coordinates are skipped,
+   shapes missing normals get smooth normals generated
+   Vertices are then welded by value and the faces reordered for the vertex cache, see mesh_processing.hpp */
+
+// Appends the meshes in the file, returns false if the file cannot be read
+bool load_obj(const elk::path& path, std::vector<mesh_t>& meshes);
@@ -1,202 +1,490 @@
 #include "occlusion.hpp"
 #include "mesh.hpp"
+#include "sampler.hpp"
+#include "surface_cache.hpp"
+#include "bake_cache.hpp"
 #include "utils.hpp"
+#include "task_scheduler.hpp"
+#include "rasterizer.hpp"
 
 #include "glm/glm.hpp"
-#include "elektra/optional.hpp"
 
-#include <thread>
-#include <mutex>
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
 #include <vector>
 #include <cstdint>
 
 using image_f32 = image<pixel_format::F32>;
 using image_u32 = image<pixel_format::U32>;
 
-struct image_tile
+static const size_t MAX_CHUNK_SIZE = 256;
+
+// NOTE(Corralx): Every bake owns its dispenser, so concurrent bakes never contend on the same counter
+// Chunks are handed out on demand, so chunks tracing more rays than others do not stall the workers
+// The texels already follow the Morton tile order of their surface cache, so consecutive chunks stay close in the image
+class work_dispenser
 {
-	image_tile(uint32_t x, uint32_t y) : starting_x(x), starting_y(y) {}
+public:
+	work_dispenser(size_t num_items, size_t chunk_size) : _num_items(num_items), _chunk_size(chunk_size), _next_chunk(0)
+	{
+		assert(chunk_size > 0);
+	}
+
+	work_dispenser(const work_dispenser&) = delete;
+	work_dispenser& operator=(const work_dispenser&) = delete;
+
+	// Returns false when every item has been handed out
+	bool next_chunk(size_t& first, size_t& last)
+	{
+		first = _next_chunk.fetch_add(1, std::memory_order_relaxed) * _chunk_size;
+		if (first >= _num_items)
+			return false;
+
+		last = std::min(first + _chunk_size, _num_items);
+		return true;
+	}
 
-	uint32_t starting_x;
-	uint32_t starting_y;
+private:
+	const size_t _num_items;
+	const size_t _chunk_size;
+	std::atomic<size_t> _next_chunk;
 };
 
-static elk::optional<image_tile> get_next_tile(std::queue<image_tile>& queue)
+// Running estimate of the occlusion of a texel
+struct texel_estimate
 {
-	static std::mutex mutex;
+	float sum = .0f;
+	float sum_squared = .0f;
+	uint32_t samples = 0;
+	uint32_t hits = 0;
+};
 
-	std::lock_guard<std::mutex> lock(mutex);
+// Per worker storage, reused across chunks so only the first chunk of each worker allocates
+struct trace_buffers
+{
+	embree::ray_stream rays;
 
-	if (queue.empty())
-		return elk::nullopt;
+	// The occlusion of each ray of the chunk and whether it hit something at all
+	std::vector<float> occlusion;
+	std::vector<uint8_t> hit;
 
-	auto tile = queue.front();
-	queue.pop();
-	return tile;
+	// The index in the chunk of each ray still traced by the stepped mode
+	std::vector<uint32_t> active;
+
+	// The estimates of the texels of the chunk and the texels still needing samples
+	std::vector<texel_estimate> estimates;
+	std::vector<uint32_t> pending;
+};
+
+static void trace_distance(embree::context& ctx, const occlusion_params& params, trace_buffers& buffers)
+{
+	auto& rays = buffers.rays;
+	ctx.intersect(rays, params.max_distance, params.min_distance);
+
+	for (size_t r = 0; r < rays.size(); ++r)
+	{
+		buffers.hit[r] = rays.ids[r] != embree::NO_HIT_ID;
+		buffers.occlusion[r] = buffers.hit[r] ? 1.f - saturate(rays.distances[r] / params.max_distance) : .0f;
+	}
 }
 
-static void process_tiles(std::queue<image_tile>& queue, embree::context& ctx, const mesh_t& mesh,
-						  const occlusion_params& params, const image_u32& indices_map, image_f32& image)
+static void trace_binary(embree::context& ctx, const occlusion_params& params, trace_buffers& buffers)
 {
-	while (true)
+	auto& rays = buffers.rays;
+	ctx.occluded(rays, params.max_distance, params.min_distance);
+
+	for (size_t r = 0; r < rays.size(); ++r)
 	{
-		auto tile_opt = get_next_tile(queue);
-		if (!tile_opt)
-			return;
+		buffers.hit[r] = rays.ids[r] != embree::NO_HIT_ID;
+		buffers.occlusion[r] = buffers.hit[r] ? 1.f : .0f;
+	}
+}
 
-		image_tile tile = tile_opt.value();
+// NOTE(Corralx): Approximates the distance falloff with any hit queries, tracing the segments from the nearest one
+// The rays blocked in a segment are removed from the stream, so the farther segments trace fewer and fewer rays
+static void trace_stepped(embree::context& ctx, const occlusion_params& params, trace_buffers& buffers)
+{
+	auto& rays = buffers.rays;
+	auto& active = buffers.active;
 
-		auto& faces = mesh.faces();
-		auto& positions = mesh.vertices();
-		auto& tex_coords = mesh.texture_coords();
-		auto& normals = mesh.normals();
+	active.resize(rays.size());
+	for (size_t r = 0; r < rays.size(); ++r)
+	{
+		active[r] = static_cast<uint32_t>(r);
+		buffers.hit[r] = 0;
+		buffers.occlusion[r] = .0f;
+	}
 
-		const uint32_t samples_per_pixel = params.quality * 8;
+	const float step = (params.max_distance - params.min_distance) / params.distance_steps;
+	for (uint32_t s = 0; s < params.distance_steps && rays.size() > 0; ++s)
+	{
+		const float near = params.min_distance + step * s;
+		const float far = (s + 1 == params.distance_steps) ? params.max_distance : near + step;
+		ctx.occluded(rays, far, near);
 
-		for (uint32_t i = tile.starting_y; i < tile.starting_y + params.tile_height; ++i)
+		// Every occluder in the segment is considered to lie in its middle
+		const float occlusion = 1.f - saturate((near + step * .5f) / params.max_distance);
+
+		size_t remaining = 0;
+		for (size_t r = 0; r < rays.size(); ++r)
 		{
-			for (uint32_t j = tile.starting_x; j < tile.starting_x + params.tile_width; ++j)
+			if (rays.ids[r] != embree::NO_HIT_ID)
+			{
+				buffers.hit[active[r]] = 1;
+				buffers.occlusion[active[r]] = occlusion;
+			}
+			else
 			{
-				const uint32_t tris_index = indices_map[i * image.width() + j];
-
-				// Check if a triangle actually cover this pixel
-				if (tris_index == std::numeric_limits<uint32_t>::max())
-					continue;
-
-				// Calculate UV coordinates for the center of the current pixel
-				const glm::vec2 p_coord{ j / static_cast<float>(image.width()),
-										 i / static_cast<float>(image.height()) };
-
-				const uint32_t v0_index = faces[tris_index].v0;
-				const uint32_t v1_index = faces[tris_index].v1;
-				const uint32_t v2_index = faces[tris_index].v2;
-
-				// Get UV coordinates for the vertices of the triangle which includes this pixel
-				const glm::vec2 v0_coord{ tex_coords[v0_index].x,
-										  tex_coords[v0_index].y };
-				const glm::vec2 v1_coord{ tex_coords[v1_index].x,
-										  tex_coords[v1_index].y };
-				const glm::vec2 v2_coord{ tex_coords[v2_index].x ,
-										  tex_coords[v2_index].y };
-
-				// Use baricentric interpolation to obtain the position and normal of the given pixel when projected on the mesh
-				// http://answers.unity3d.com/questions/383804/calculate-uv-coordinates-of-3d-point-on-plane-of-m.html
-				const glm::vec2 p0_coord = v0_coord - p_coord;
-				const glm::vec2 p1_coord = v1_coord - p_coord;
-				const glm::vec2 p2_coord = v2_coord - p_coord;
-
-				const float area_tris = glm::length(glm::cross(glm::vec3(p0_coord - p1_coord, .0f), glm::vec3(p0_coord - p2_coord, .0f)));
-				const float area0 = glm::length(glm::cross(glm::vec3(p1_coord, .0f), glm::vec3(p2_coord, .0f))) / area_tris;
-				const float area1 = glm::length(glm::cross(glm::vec3(p2_coord, .0f), glm::vec3(p0_coord, .0f))) / area_tris;
-				const float area2 = glm::length(glm::cross(glm::vec3(p0_coord, .0f), glm::vec3(p1_coord, .0f))) / area_tris;
-
-				const glm::vec3 v0{ positions[v0_index].x,
-									positions[v0_index].y,
-									positions[v0_index].z };
-
-				const glm::vec3 v1{ positions[v1_index].x,
-									positions[v1_index].y,
-									positions[v1_index].z };
-
-				const glm::vec3 v2{	positions[v2_index].x,
-									positions[v2_index].y,
-									positions[v2_index].z };
-
-				const glm::vec3 p = v0 * area0 + v1 * area1 + v2 * area2;
-
-				const glm::vec3 n0{ normals[v0_index].x,
-									normals[v0_index].y,
-									normals[v0_index].z };
-
-				const glm::vec3 n1{ normals[v1_index].x,
-									normals[v1_index].y,
-									normals[v1_index].z };
-
-				const glm::vec3 n2{ normals[v2_index].x,
-									normals[v2_index].y,
-									normals[v2_index].z };
-
-				// Setting smooth_inter_normal to false will just take the mean value of the normals
-				glm::vec3 n;
-				if (params.smooth_normal_interpolation)
-					n = n0 * area0 + n1 * area1 + n2 * area2;
-				else
-					n = (n0 + n1 + n2) / 3.f;
-
-				// Generate the rays in groups of 8, to make use of Embree AVX2 capabilities
-				uint32_t num_hit = 0;
-				float occlusion = .0f;
-				for (uint32_t q = 0; q < params.quality; ++q)
-				{
-					embree::ray ray;
-
-					for (uint32_t ray_id = 0; ray_id < 8; ++ray_id)
-					{
-						ray.positions[ray_id] = p;
-
-						const glm::vec3 dir = cosine_weighted_hemisphere_sample(n);
-						ray.directions[ray_id] = dir;
-					}
-
-					auto result = ctx.intersect(ray, params.max_distance, params.min_distance);
-
-					// Sum up occlusion for each hit accounting for attenuation
-					for (uint32_t ray_id = 0; ray_id < 8; ++ray_id)
-					{
-						if (result.ids[ray_id] != embree::NO_HIT_ID)
-						{
-							occlusion += 1.f - saturate(result.distances[ray_id] / params.max_distance);
-							++num_hit;
-						}
-					}
-				}
-
-				if (num_hit > 0)
-				{
-					occlusion /= samples_per_pixel;
-					occlusion /= params.linear_attenuation;
-					occlusion = std::pow(occlusion, params.quadratic_attenuation);
-					image[i * image.width() + j] = saturate(occlusion);
-				}
+				rays.copy(r, remaining);
+				active[remaining] = active[r];
+				++remaining;
 			}
 		}
+
+		rays.resize(remaining);
 	}
 }
 
-static void generate_occlusion_helper(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
-									  const image_u32& indices_map, image_f32& image, std::promise<void> promise)
+// Standard error of the mean of the samples traced so far
+static float standard_error(const texel_estimate& estimate)
 {
-	std::vector<std::thread> workers;
-	std::queue<image_tile> queue;
+	assert(estimate.samples > 1);
+
+	const float n = static_cast<float>(estimate.samples);
+	const float mean = estimate.sum / n;
+	const float variance = std::max(.0f, (estimate.sum_squared - mean * estimate.sum) / (n - 1.f));
+	return std::sqrt(variance / n);
+}
 
+static void trace_rays(embree::context& ctx, const occlusion_params& params, trace_buffers& buffers)
+{
+	switch (params.mode)
+	{
+	case occlusion_mode::DISTANCE:
+		trace_distance(ctx, params, buffers);
+		break;
+	case occlusion_mode::BINARY:
+		trace_binary(ctx, params, buffers);
+		break;
+	case occlusion_mode::STEPPED:
+		trace_stepped(ctx, params, buffers);
+		break;
+	}
+}
+
+// Bakes the texels [first, last) of the cache
+static void process_chunk(const surface_cache& cache, embree::context& ctx, const occlusion_params& params,
+						  image_f32& image, size_t first, size_t last, trace_buffers& buffers)
+{
+	const uint32_t min_packets = params.adaptive_sampling ? params.min_quality : params.quality;
+	const uint32_t max_samples = (params.adaptive_sampling ? params.max_quality : params.quality) * 8;
+
+	auto& rays = buffers.rays;
+	auto& estimates = buffers.estimates;
+	auto& pending = buffers.pending;
+
+	estimates.assign(last - first, texel_estimate{});
+	pending.resize(last - first);
+	for (uint32_t i = 0; i < pending.size(); ++i)
+		pending[i] = i;
+
+	// Every texel traces min_packets first, then the noisy ones keep adding a packet per round
+	uint32_t packets = min_packets;
+	while (!pending.empty())
+	{
+		const uint32_t samples_per_texel = packets * 8;
+		const size_t num_rays = pending.size() * samples_per_texel;
+		buffers.occlusion.resize(num_rays);
+		buffers.hit.resize(num_rays);
+
+		// Generate every sample of the round and trace them with a single call
+		rays.resize(num_rays);
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			const size_t t = first + pending[i];
+			const glm::vec3 p = cache.positions.get(t);
+			const glm::vec3 n = cache.normals.get(t);
+			const glm::vec3 tangent = cache.tangents.get(t);
+			const glm::vec3 bitangent = cache.bitangents.get(t);
+
+			// Seeded by the pixel, so every bake of the same texel draws the same directions
+			// Later rounds continue the sequence of the texel where the previous one stopped
+			const sobol_sampler sampler(hash_seed(cache.pixels[t]));
+			const uint32_t first_sample = estimates[pending[i]].samples;
+
+			const size_t first_ray = i * samples_per_texel;
+			std::fill_n(rays.origin_x.begin() + first_ray, samples_per_texel, p.x);
+			std::fill_n(rays.origin_y.begin() + first_ray, samples_per_texel, p.y);
+			std::fill_n(rays.origin_z.begin() + first_ray, samples_per_texel, p.z);
+
+			// Directions are generated a packet at a time straight into the stream
+			for (uint32_t packet = 0; packet < packets; ++packet)
+			{
+				const size_t ray = first_ray + packet * 8;
+
+				float u_x[8];
+				float u_y[8];
+				sampler.sample(first_sample + packet * 8, 8, u_x, u_y);
+				cosine_weighted_hemisphere_sample_8(u_x, u_y, n, tangent, bitangent,
+													&rays.direction_x[ray], &rays.direction_y[ray], &rays.direction_z[ray]);
+			}
+		}
+
+		trace_rays(ctx, params, buffers);
+
+		size_t remaining = 0;
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			texel_estimate& estimate = estimates[pending[i]];
+
+			const size_t first_ray = i * samples_per_texel;
+			for (uint32_t ray_id = 0; ray_id < samples_per_texel; ++ray_id)
+			{
+				const float occlusion = buffers.occlusion[first_ray + ray_id];
+				estimate.sum += occlusion;
+				estimate.sum_squared += occlusion * occlusion;
+				estimate.hits += buffers.hit[first_ray + ray_id];
+			}
+			estimate.samples += samples_per_texel;
+
+			if (estimate.samples < max_samples && standard_error(estimate) > params.target_error)
+				pending[remaining++] = pending[i];
+		}
+
+		pending.resize(remaining);
+		packets = 1;
+	}
+
+	for (size_t t = first; t < last; ++t)
+	{
+		const texel_estimate& estimate = estimates[t - first];
+
+		// Apply the attenuation to the mean occlusion
+		if (estimate.hits > 0)
+		{
+			float occlusion = estimate.sum / estimate.samples;
+			occlusion /= params.linear_attenuation;
+			occlusion = std::pow(occlusion, params.quadratic_attenuation);
+			image[cache.pixels[t]] = saturate(occlusion);
+		}
+	}
+}
+
+static void check_params(const occlusion_params& params)
+{
 	assert(params.worker_num > 0);
-	assert(image.width() % params.tile_width == 0);
-	assert(image.height() % params.tile_height == 0);
 	assert(params.quality > 0);
+	assert(!params.adaptive_sampling || (params.min_quality > 0 && params.min_quality <= params.max_quality));
+	assert(params.mode != occlusion_mode::STEPPED || params.distance_steps > 0);
+	(void)params;
+}
+
+// A few chunks per worker, small enough to balance the load and big enough to keep the counter cold
+// The cap bounds the ray stream of a chunk, which holds every sample of its texels
+static size_t chunk_size(size_t num_texels, uint32_t worker_num)
+{
+	return std::min<size_t>(MAX_CHUNK_SIZE, std::max<size_t>(64, num_texels / (worker_num * 16)));
+}
+
+static void bake_surface_cache(embree::context& ctx, const surface_cache& cache, const occlusion_params& params, image_f32& image)
+{
+	check_params(params);
+	assert(image.width() == cache.width && image.height() == cache.height);
+	// The normals come from the cache, a cache built with another interpolation would bake with the wrong ones
+	assert(cache.smooth_normal_interpolation == params.smooth_normal_interpolation);
+
+	work_dispenser dispenser(cache.size(), chunk_size(cache.size(), params.worker_num));
+
+	task_scheduler::instance().parallel_for(params.worker_num, [&](uint32_t)
+	{
+		trace_buffers buffers;
+		size_t first = 0;
+		size_t last = 0;
+		while (dispenser.next_chunk(first, last))
+			process_chunk(cache, ctx, params, image, first, last, buffers);
+	});
+}
+
+static void generate_occlusion_helper(embree::context& ctx, const mesh_t& mesh, glm::mat4 transform, const occlusion_params& params,
+									  const image_u32& indices_map, image_f32& image, std::promise<void> promise)
+{
+	assert(image.width() == indices_map.width() && image.height() == indices_map.height());
 
-	const uint32_t num_tile_width = image.width() / params.tile_width;
-	const uint32_t num_tile_height = image.height() / params.tile_height;
+	surface_cache cache;
+	auto cache_future = build_surface_cache(mesh, indices_map, params, cache, transform);
+	task_scheduler::instance().wait(cache_future);
+	cache_future.get();
+	bake_surface_cache(ctx, cache, params, image);
 
-	for (uint32_t i = 0; i < num_tile_height; ++i)
-		for (uint32_t j = 0; j < num_tile_width; ++j)
-			queue.emplace(j * params.tile_width, i * params.tile_height);
+	promise.set_value();
+}
 
-	for (uint32_t w = 0; w < params.worker_num; ++w)
-		workers.push_back(std::thread(process_tiles, std::ref(queue), std::ref(ctx),
-									  std::ref(mesh), params, std::ref(indices_map), std::ref(image)));
+static void generate_occlusion_lookup_helper(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
+											 const image_u32& indices_map, image_f32& image, const bake_cache& cache,
+											 std::promise<void> promise)
+{
+	const uint64_t key = bake_cache::key(ctx, mesh, params, indices_map);
+	if (!cache.load(key, indices_map, image))
+	{
+		surface_cache surface;
+		auto surface_future = build_surface_cache(mesh, indices_map, params, surface);
+		task_scheduler::instance().wait(surface_future);
+		surface_future.get();
 
-	for (auto& w : workers)
-		w.join();
+		bake_surface_cache(ctx, surface, params, image);
+
+		// NOTE(Corralx): A failed store only costs a bake next time, so it is not reported
+		cache.store(key, image);
+	}
+
+	promise.set_value();
+}
+
+static void generate_occlusion_cached_helper(embree::context& ctx, const surface_cache& cache, const occlusion_params& params,
+											 image_f32& image, std::promise<void> promise)
+{
+	bake_surface_cache(ctx, cache, params, image);
 
 	promise.set_value();
 }
 
-// TODO(Corralx): Eventually cache occlusions map for params set
-// TODO(Corralx): Separate ray occlusion calculation from occlusion map generation to reuse data
 std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
 										 const image_u32& indices_map, image_f32& image)
 {
-	return async_apply(generate_occlusion_helper, std::ref(ctx), std::ref(mesh),
+	return async_apply(generate_occlusion_helper, std::ref(ctx), std::ref(mesh), glm::mat4(1.f),
 					   std::ref(params), std::ref(indices_map), std::ref(image));
 }
+
+std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const glm::mat4& transform,
+										 const occlusion_params& params, const image_u32& indices_map, image_f32& image)
+{
+	return async_apply(generate_occlusion_helper, std::ref(ctx), std::ref(mesh), transform,
+					   std::ref(params), std::ref(indices_map), std::ref(image));
+}
+
+std::future<void> generate_occlusion_map(embree::context& ctx, const surface_cache& cache, const occlusion_params& params,
+										 image_f32& image)
+{
+	return async_apply(generate_occlusion_cached_helper, std::ref(ctx), std::ref(cache), std::ref(params), std::ref(image));
+}
+
+std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
+										 const image_u32& indices_map, image_f32& image, const bake_cache& cache)
+{
+	return async_apply(generate_occlusion_lookup_helper, std::ref(ctx), std::ref(mesh), std::ref(params),
+					   std::ref(indices_map), std::ref(image), std::ref(cache));
+}
+
+// A range of texels of a job of the scene bake
+struct scene_chunk
+{
+	uint32_t job;
+	size_t first;
+	size_t last;
+};
+
+// The cache is optional, null when the scene is always baked
+static void bake_scene_helper(embree::context& ctx, std::vector<bake_job>& jobs, uint32_t worker_num, const bake_cache* cache,
+							  std::promise<void> promise)
+{
+	assert(worker_num > 0);
+	auto& scheduler = task_scheduler::instance();
+
+	auto wait_all = [&](std::vector<std::future<void>>& futures)
+	{
+		for (auto& future : futures)
+		{
+			scheduler.wait(future);
+			future.get();
+		}
+		futures.clear();
+	};
+
+	// Every job is rasterized and then reconstructed concurrently with the others
+	std::vector<std::future<void>> futures;
+	for (bake_job& job : jobs)
+	{
+		check_params(job.params);
+		futures.push_back(rasterize_triangle_software(*job.mesh, job.indices_map, job.supersampling));
+	}
+	wait_all(futures);
+
+	// The jobs found in the bake cache keep an empty surface cache, so they get no chunks
+	std::vector<uint64_t> keys(jobs.size());
+	std::vector<bool> cached(jobs.size(), false);
+	if (cache)
+	{
+		for (size_t j = 0; j < jobs.size(); ++j)
+		{
+			keys[j] = bake_cache::key(ctx, *jobs[j].mesh, jobs[j].params, jobs[j].indices_map, jobs[j].transform);
+			cached[j] = cache->load(keys[j], jobs[j].indices_map, jobs[j].occlusion_map);
+		}
+	}
+
+	std::vector<surface_cache> caches(jobs.size());
+	for (size_t j = 0; j < jobs.size(); ++j)
+	{
+		if (!cached[j])
+			futures.push_back(build_surface_cache(*jobs[j].mesh, jobs[j].indices_map, jobs[j].params, caches[j], jobs[j].transform));
+	}
+	wait_all(futures);
+
+	// Round robin over the jobs, so the small ones finish early and the big ones keep every worker busy until the end
+	std::vector<size_t> chunk_sizes(jobs.size());
+	size_t max_chunks = 0;
+	for (size_t j = 0; j < jobs.size(); ++j)
+	{
+		chunk_sizes[j] = chunk_size(caches[j].size(), worker_num);
+		max_chunks = std::max(max_chunks, (caches[j].size() + chunk_sizes[j] - 1) / chunk_sizes[j]);
+	}
+
+	std::vector<scene_chunk> chunks;
+	for (size_t c = 0; c < max_chunks; ++c)
+	{
+		for (size_t j = 0; j < jobs.size(); ++j)
+		{
+			const size_t first = c * chunk_sizes[j];
+			if (first < caches[j].size())
+				chunks.push_back({ static_cast<uint32_t>(j), first, std::min(first + chunk_sizes[j], caches[j].size()) });
+		}
+	}
+
+	work_dispenser dispenser(chunks.size(), 1);
+	scheduler.parallel_for(worker_num, [&](uint32_t)
+	{
+		trace_buffers buffers;
+		size_t first = 0;
+		size_t last = 0;
+		while (dispenser.next_chunk(first, last))
+		{
+			const scene_chunk& chunk = chunks[first];
+			bake_job& job = jobs[chunk.job];
+			process_chunk(caches[chunk.job], ctx, job.params, job.occlusion_map, chunk.first, chunk.last, buffers);
+		}
+	});
+
+	// NOTE(Corralx): A failed store only costs a bake next time, so it is not reported
+	if (cache)
+	{
+		for (size_t j = 0; j < jobs.size(); ++j)
+		{
+			if (!cached[j])
+				cache->store(keys[j], jobs[j].occlusion_map);
+		}
+	}
+
+	promise.set_value();
+}
+
+std::future<void> bake_scene(embree::context& ctx, std::vector<bake_job>& jobs, uint32_t worker_num)
+{
+	return async_apply(bake_scene_helper, std::ref(ctx), std::ref(jobs), worker_num, static_cast<const bake_cache*>(nullptr));
+}
+
+std::future<void> bake_scene(embree::context& ctx, std::vector<bake_job>& jobs, uint32_t worker_num, const bake_cache& cache)
+{
+	return async_apply(bake_scene_helper, std::ref(ctx), std::ref(jobs), worker_num, &cache);
+}
@@ -2,30 +2,57 @@
 
 #include <cstdint>
 #include <future>
+#include <vector>
 
 #include "image.hpp"
 #include "embree.hpp"
 
 class mesh_t;
+struct surface_cache;
+class bake_cache;
+
+enum class occlusion_mode : uint8_t
+{
+	// Every hit is weighted by its distance, requires a closest hit query per ray
+	DISTANCE,
+	// Every hit counts as fully occluded, uses the cheaper any hit queries
+	BINARY,
+	// The distance is quantized in steps, each one traced as an any hit query over a segment of the ray
+	STEPPED
+};
 
 struct occlusion_params
 {
 	// Rays are packet by 8, so the number of samples per pixel is quality * 8
 	uint32_t quality = 1;
 
+	// Adaptive sampling replaces quality, every texel traces min_quality packets and then keeps adding
+	// a packet at a time until the standard error of its occlusion drops below target_error or max_quality is reached
+	bool adaptive_sampling = false;
+	uint32_t min_quality = 1;
+	uint32_t max_quality = 8;
+	float target_error = .01f;
+
 	// The min and max distance the system search for an occluder
 	float min_distance = .0001f;
 	float max_distance = 100.f;
 
+	// How the distance of the occluders contributes to the occlusion
+	occlusion_mode mode = occlusion_mode::DISTANCE;
+
+	// The number of segments [min_distance, max_distance] is split in, used only by the stepped mode
+	uint32_t distance_steps = 4;
+
 	// TODO(Corralx): Let the user personalize the occlusion calculation through a lambda?
 	// The attenuation parameter used to calculate final occlusion
 	float quadratic_attenuation = 1.f;
 	float linear_attenuation = 1.f;
 
-	// The number of workers (aka threads) and the size of the tile each worker works onto
-	// NOTE(Corralx): The tile size must always be a divisor of the occlusion map size!
+	// The size of the tiles used to order the covered pixels, any size is allowed
 	uint32_t tile_width = 64;
 	uint32_t tile_height = 64;
+
+	// The number of workers running concurrently on the shared task scheduler
 	uint8_t worker_num = 8;
 
 	// Setting this to false disable barycentric interpolation for the normals and use the mean instead
@@ -37,3 +64,53 @@ struct occlusion_params
    if a default value is needed, call initialize(...) on the image before submitting */
 std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
 										 const image<pixel_format::U32>& indices_map, image<pixel_format::F32>& image);
+
+// Same as above, for an instance of the mesh placed in the scene with the given transform
+std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const glm::mat4& transform,
+										 const occlusion_params& params, const image<pixel_format::U32>& indices_map,
+										 image<pixel_format::F32>& image);
+
+// Same as above, but reuses the surface data of a cache built with build_surface_cache(...)
+/* NOTE(Corralx): The cache has to outlive the future, and the image must have the same size of the indices map it was built from
+   Only the ray and shading parameters are taken from params, the normal interpolation has to match the one of the cache
+   (asserted) and the tile size is ignored, the texels keep the order of the cache, which never changes the result */
+std::future<void> generate_occlusion_map(embree::context& ctx, const surface_cache& cache, const occlusion_params& params,
+										 image<pixel_format::F32>& image);
+
+// Same as the first overload, but returns the map stored in the cache if any, and stores it after baking otherwise
+std::future<void> generate_occlusion_map(embree::context& ctx, const mesh_t& mesh, const occlusion_params& params,
+										 const image<pixel_format::U32>& indices_map, image<pixel_format::F32>& image,
+										 const bake_cache& cache);
+
+// A mesh of the scene baked by bake_scene(...) into its own occlusion map
+struct bake_job
+{
+	bake_job(const mesh_t& mesh, uint32_t width, uint32_t height, const occlusion_params& params,
+			 const glm::mat4& transform = glm::mat4(1.f)) :
+			 mesh(&mesh), transform(transform), params(params), occlusion_map(width, height), indices_map(width, height)
+	{
+		occlusion_map.reset(0);
+		indices_map.reset(255);
+	}
+
+	const mesh_t* mesh;
+	// The placement of the mesh in the scene, for instances
+	glm::mat4 transform;
+	occlusion_params params;
+	// Supersampling factor of the UV rasterization
+	uint8_t supersampling = 2;
+
+	// Only the pixels covered by the UV unwrap are written, the others stay zero
+	image<pixel_format::F32> occlusion_map;
+	// The rasterized UV unwrap, kept as the coverage mask of the postprocessing
+	image<pixel_format::U32> indices_map;
+};
+
+// When the future is ready, the occlusion map of every job is baked
+/* NOTE(Corralx): The UV unwraps are rasterized and the surface caches built for every job first, then the chunks
+   of every job are interleaved in a single queue shared by the workers, so no worker idles while any job has texels left
+   The worker_num of the jobs is ignored in favour of the one given */
+std::future<void> bake_scene(embree::context& ctx, std::vector<bake_job>& jobs, uint32_t worker_num);
+
+// Same as above, but the jobs stored in the cache are loaded instead of baked, and the others are stored after baking
+std::future<void> bake_scene(embree::context& ctx, std::vector<bake_job>& jobs, uint32_t worker_num, const bake_cache& cache);
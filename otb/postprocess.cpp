@@ -1,135 +1,1343 @@
 #include "postprocess.hpp"
 #include "utils.hpp"
+#include "task_scheduler.hpp"
+#include "mesh.hpp"
+#include "mesh_processing.hpp"
 
-#include <thread>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 using image_f32 = image<pixel_format::F32>;
+using image_u32 = image<pixel_format::U32>;
+using image_u8 = image<pixel_format::U8>;
+using image_u16 = image<pixel_format::U16>;
+
+static const uint32_t NO_SEED = std::numeric_limits<uint32_t>::max();
+static const uint32_t NO_FACE = std::numeric_limits<uint32_t>::max();
+
+// Splits [0, count) into one contiguous range per scheduler worker
+template<typename Func>
+static void parallel_ranges(uint32_t count, Func f)
+{
+	auto& scheduler = task_scheduler::instance();
+	const uint32_t num_ranges = std::min(count, scheduler.worker_count());
+	const uint32_t range_size = (count + num_ranges - 1) / num_ranges;
+
+	scheduler.parallel_for(num_ranges, [&](uint32_t range)
+	{
+		f(range * range_size, std::min(count, (range + 1) * range_size));
+	});
+}
 
-static void invert_helper(image_f32& image, std::promise<void> promise)
+static void dilate_texels(image_f32& image, const image_u32& indices_map, uint32_t padding)
 {
+	assert(image.width() == indices_map.width() && image.height() == indices_map.height());
+	if (padding == 0)
+		return;
+
 	const uint32_t h = image.height();
 	const uint32_t w = image.width();
 
-	for (uint32_t i = 0; i < h; ++i)
+	/* NOTE(Corralx): Exact euclidean feature transform (Meijster et al.), separable in a pass over the columns
+	   and one over the rows, so the cost is linear in the texels whatever the padding is
+	   The first pass finds the row of the nearest covered texel in each column, walking down and then up */
+	std::vector<uint32_t> nearest_row(static_cast<size_t>(w) * h);
+	parallel_ranges(w, [&](uint32_t first_column, uint32_t last_column)
 	{
-		for (uint32_t j = 0; j < w; ++j)
+		for (uint32_t x = first_column; x < last_column; ++x)
+			nearest_row[x] = indices_map[x] != std::numeric_limits<uint32_t>::max() ? 0 : NO_SEED;
+
+		for (uint32_t y = 1; y < h; ++y)
+		{
+			const size_t row = static_cast<size_t>(y) * w;
+			for (uint32_t x = first_column; x < last_column; ++x)
+				nearest_row[row + x] = indices_map[row + x] != std::numeric_limits<uint32_t>::max() ? y : nearest_row[row - w + x];
+		}
+
+		for (uint32_t y = h - 1; y-- > 0;)
 		{
-			uint32_t index = i * w + j;
-			float value = image[index];
+			const size_t row = static_cast<size_t>(y) * w;
+			for (uint32_t x = first_column; x < last_column; ++x)
+			{
+				const uint32_t below = nearest_row[row + w + x];
+				uint32_t& current = nearest_row[row + x];
+				if (below != NO_SEED && (current == NO_SEED || below - y < y - current))
+					current = below;
+			}
+		}
+	});
+
+	// The second pass finds in each row the column minimizing the distance, with the lower envelope of the parabolas
+	// centered on each column, the texels further than any covered one have the height of an empty map
+	const int64_t infinity = static_cast<int64_t>(w) + h;
+	const uint64_t max_distance = padding != DILATE_WHOLE_MAP ? static_cast<uint64_t>(padding) * padding : std::numeric_limits<uint64_t>::max();
+
+	parallel_ranges(h, [&](uint32_t first_row, uint32_t last_row)
+	{
+		std::vector<int64_t> height(w);
+		std::vector<int64_t> sites(w);
+		std::vector<int64_t> starts(w);
+
+		auto distance = [&](int64_t x, int64_t site)
+		{
+			return (x - site) * (x - site) + height[site] * height[site];
+		};
+
+		for (uint32_t y = first_row; y < last_row; ++y)
+		{
+			const size_t row = static_cast<size_t>(y) * w;
+			for (uint32_t x = 0; x < w; ++x)
+			{
+				const uint32_t seed_row = nearest_row[row + x];
+				height[x] = seed_row != NO_SEED ? std::abs(static_cast<int64_t>(seed_row) - y) : infinity;
+			}
+
+			int64_t q = 0;
+			sites[0] = 0;
+			starts[0] = 0;
+			for (int64_t u = 1; u < w; ++u)
+			{
+				while (q >= 0 && distance(starts[q], sites[q]) > distance(starts[q], u))
+					--q;
+
+				if (q < 0)
+				{
+					q = 0;
+					sites[0] = u;
+				}
+				else
+				{
+					// First column where the parabola of u is below the one of the last site
+					const int64_t site = sites[q];
+					const int64_t start = 1 + (u * u - site * site + height[u] * height[u] - height[site] * height[site]) / (2 * (u - site));
+					if (start < w)
+					{
+						++q;
+						sites[q] = u;
+						starts[q] = start;
+					}
+				}
+			}
 
-			image[index] = saturate(1.f - value);
+			for (int64_t u = w - 1; u >= 0; --u)
+			{
+				// The seeds are covered texels, which are never written, so the image can be filled in place
+				const int64_t site = sites[q];
+				const uint32_t seed_row = nearest_row[row + site];
+				const uint64_t seed_distance = static_cast<uint64_t>(distance(u, site));
+				if (seed_row != NO_SEED && seed_distance > 0 && seed_distance <= max_distance)
+					image[row + u] = image[static_cast<size_t>(seed_row) * w + site];
+
+				if (u == starts[q])
+					--q;
+			}
 		}
+	});
+
+}
+
+// Columns and rows of the tiles of the vertical pass, a tile reads kernel taps more rows than it writes
+static const uint32_t BLUR_TILE_WIDTH = 512;
+static const uint32_t BLUR_TILE_HEIGHT = 64;
+
+// out[i] = sum of kernel[t] * sources[t][i], the sources are already offset and clamped by the caller
+static void weighted_sum(const float* const* sources, const float* kernel, uint32_t taps, float* out, uint32_t count)
+{
+	uint32_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (uint32_t t = 0; t < taps; ++t)
+			sum = _mm256_fmadd_ps(_mm256_set1_ps(kernel[t]), _mm256_loadu_ps(sources[t] + i), sum);
+		_mm256_storeu_ps(out + i, sum);
 	}
+#endif
 
-	promise.set_value();
+	for (; i < count; ++i)
+	{
+		float sum = .0f;
+		for (uint32_t t = 0; t < taps; ++t)
+			sum += kernel[t] * sources[t][i];
+		out[i] = sum;
+	}
 }
 
-std::future<void> invert(image_f32& image)
+static const uint8_t BAYER_MATRIX[8][8] =
+{
+	{ 0, 32, 8, 40, 2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44, 4, 36, 14, 46, 6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{ 3, 35, 11, 43, 1, 33, 9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47, 7, 39, 13, 45, 5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// The threshold maps of the ordered dithers are tiled over the image with this size
+static const uint32_t THRESHOLD_MAP_SIZE = 64;
+
+// Ranks of the texels of a tileable blue noise pattern, generated offline with the void and cluster method (Ulichney)
+/* NOTE(Corralx): The energy of a texel is the sum of a gaussian (sigma 1.5 texels) of the toroidal distance to every set texel,
+   the initial pattern sets a tenth of the texels, then the tightest clusters are ranked down from it and the largest voids up
+   Shipped as a table like the Bayer matrix, ranking it at runtime costs about 100 ms on the first dithered map */
+static const uint16_t BLUE_NOISE_RANKS[64][64] =
+{
+	{
+		587, 2766, 932, 264, 3178, 2592, 2090, 3831, 312, 2279, 4029, 437, 3234, 868, 567, 1534,
+		3253, 2541, 835, 1429, 3282, 1043, 3932, 2906, 1346, 565, 3843, 2657, 622, 1368, 2920, 130,
+		1229, 495, 2762, 1511, 2905, 472, 2633, 772, 3200, 2324, 3884, 1640, 43, 4034, 1523, 2714,
+		201, 788, 1601, 2029, 563, 1449, 2636, 2281, 3485, 268, 2181, 2511, 510, 2048, 1254, 4070
+	},
+	{
+		2124, 3097, 3740, 2339, 1444, 552, 3498, 1159, 1824, 2899, 976, 2099, 1238, 3917, 2728, 3534,
+		248, 3859, 1962, 3587, 630, 2439, 1892, 90, 2530, 3409, 2251, 1630, 3706, 2051, 3463, 1727,
+		3105, 1916, 3309, 79, 3975, 972, 3081, 1467, 1819, 320, 977, 3476, 2487, 3088, 829, 3461,
+		2436, 3896, 2913, 2349, 3595, 3017, 3855, 793, 1608, 3116, 1295, 3758, 1728, 3541, 2589, 252
+	},
+	{
+		1179, 1738, 395, 1940, 4008, 2950, 824, 2391, 3280, 640, 1616, 3482, 2516, 108, 1944, 1023,
+		2356, 1299, 3110, 169, 2724, 1239, 3643, 3133, 2049, 962, 358, 3128, 1158, 267, 2360, 952,
+		3919, 2458, 826, 2206, 1755, 2362, 3731, 138, 2539, 3335, 2872, 656, 1259, 1791, 2167, 310,
+		1382, 1891, 427, 1150, 207, 1847, 1236, 112, 3703, 1890, 856, 2825, 71, 951, 1549, 3260
+	},
+	{
+		3887, 3394, 792, 2712, 1191, 197, 1668, 3690, 120, 2632, 3780, 342, 1452, 2973, 3637, 1674,
+		719, 2839, 516, 2156, 4090, 1722, 467, 786, 1518, 3961, 2824, 1894, 773, 4052, 2780, 583,
+		1434, 366, 3677, 1176, 3371, 603, 1314, 2069, 4063, 1140, 1704, 2230, 3846, 458, 3709, 2812,
+		3327, 965, 3749, 3195, 2507, 683, 2203, 3311, 2688, 2384, 329, 3293, 2091, 3814, 2910, 709
+	},
+	{
+		146, 2445, 1580, 3575, 2237, 3232, 2020, 2808, 1388, 908, 1988, 3111, 757, 2190, 460, 3166,
+		3986, 1858, 3517, 1520, 913, 2901, 2326, 3359, 2683, 170, 1296, 3611, 2217, 1477, 3331, 1936,
+		3523, 2896, 1609, 2704, 338, 3009, 3524, 864, 2811, 505, 3570, 177, 2708, 3242, 1072, 1628,
+		648, 2581, 2066, 1432, 3504, 2778, 4037, 1413, 529, 1102, 3969, 1455, 2548, 429, 1885, 2260
+	},
+	{
+		2826, 1025, 3040, 292, 672, 3837, 1041, 394, 4056, 3410, 2461, 1688, 3956, 1061, 2598, 1402,
+		21, 2543, 1109, 2410, 3237, 114, 3824, 1089, 1751, 3516, 2432, 490, 2985, 62, 2536, 1136,
+		232, 2075, 768, 4009, 1953, 2481, 1662, 212, 2315, 1871, 3127, 1481, 776, 1931, 2337, 230,
+		4044, 3112, 44, 808, 1687, 277, 925, 1802, 2902, 2026, 3051, 742, 3506, 1037, 3201, 1359
+	},
+	{
+		3445, 2034, 3977, 1417, 1829, 2922, 2503, 1554, 2196, 541, 1170, 72, 2757, 3452, 1921, 3771,
+		891, 3073, 294, 3763, 687, 1414, 1998, 428, 2266, 660, 3147, 1031, 1762, 3753, 748, 3161,
+		3862, 2495, 3259, 38, 1427, 928, 3911, 3289, 1336, 3800, 978, 2498, 3924, 1294, 3023, 3522,
+		1789, 1303, 2271, 3903, 2932, 2123, 3729, 3217, 54, 3573, 1666, 384, 2348, 1760, 3953, 604
+	},
+	{
+		1693, 416, 842, 2383, 3537, 15, 770, 3347, 2861, 1823, 3143, 3664, 1367, 323, 661, 2258,
+		3353, 1607, 2083, 2820, 1805, 3596, 2715, 3182, 4038, 1451, 2027, 3906, 2651, 1264, 2116, 1639,
+		507, 1379, 1046, 3503, 2250, 2925, 430, 2621, 679, 2940, 28, 2100, 3393, 325, 697, 2517,
+		947, 2841, 522, 3374, 1113, 457, 2359, 1235, 2494, 833, 2717, 3842, 1286, 2953, 60, 2588
+	},
+	{
+		1175, 3768, 2787, 3268, 1195, 1997, 3720, 1253, 213, 3915, 783, 1999, 2350, 3000, 1670, 2687,
+		1151, 554, 3971, 1249, 346, 2363, 794, 1182, 7, 2918, 873, 220, 3296, 433, 3554, 2851,
+		2335, 3050, 1866, 2673, 623, 3746, 1228, 1810, 2183, 3588, 1691, 597, 2864, 1556, 3765, 2137,
+		181, 3807, 1508, 2453, 1909, 3618, 1584, 628, 3989, 1491, 2113, 242, 3412, 882, 2104, 3579
+	},
+	{
+		3096, 2155, 178, 1571, 535, 3008, 2618, 1611, 2382, 1081, 2685, 438, 3403, 867, 4045, 131,
+		3544, 2957, 2489, 917, 3413, 3098, 1578, 3722, 2518, 1731, 3586, 2455, 1569, 2269, 968, 99,
+		4071, 848, 324, 3632, 1565, 2047, 3333, 244, 3169, 1124, 2605, 4051, 1004, 1942, 2735, 1241,
+		3426, 1864, 3148, 780, 115, 3093, 2733, 3323, 194, 2992, 1035, 3191, 1813, 2519, 1498, 729
+	},
+	{
+		350, 1808, 2558, 4079, 2275, 942, 3875, 455, 3479, 3055, 1516, 3786, 1184, 1796, 3184, 1440,
+		2018, 382, 1745, 3662, 2135, 172, 1959, 610, 3363, 2198, 1291, 517, 3078, 3851, 1884, 1442,
+		3321, 2025, 1275, 3130, 125, 1011, 2466, 3874, 823, 1483, 352, 2310, 3144, 113, 3308, 815,
+		2574, 442, 1083, 2670, 4091, 1324, 875, 2087, 1768, 3713, 2299, 680, 3601, 446, 4015, 2713
+	},
+	{
+		1322, 3477, 671, 1112, 3391, 150, 1773, 2185, 713, 1920, 100, 2490, 2163, 286, 2579, 701,
+		2367, 3806, 1318, 649, 2846, 1411, 3935, 2672, 293, 807, 4005, 2743, 1141, 732, 2807, 2441,
+		544, 3741, 2597, 2220, 3988, 2875, 561, 1656, 2791, 3697, 3015, 1782, 1331, 3853, 569, 1713,
+		3925, 2229, 3634, 1602, 2161, 403, 2550, 3894, 1148, 412, 2639, 1393, 2848, 1131, 2264, 3288
+	},
+	{
+		955, 3752, 2853, 1964, 3119, 1431, 3598, 2963, 1040, 3994, 3270, 646, 3623, 2912, 3897, 1108,
+		3375, 2771, 75, 3250, 2462, 825, 3030, 1095, 1605, 3262, 1876, 92, 2119, 3466, 278, 3189,
+		1050, 1642, 387, 767, 1781, 1340, 3483, 2292, 70, 2024, 684, 3447, 896, 2035, 2424, 2966,
+		1396, 20, 3281, 658, 2952, 3414, 1562, 586, 2881, 3497, 1651, 9, 3861, 1956, 225, 1695
+	},
+	{
+		2328, 89, 1512, 408, 2409, 737, 2702, 303, 2369, 1300, 2763, 1701, 983, 1410, 1967, 459,
+		1633, 797, 1949, 4054, 1690, 376, 3606, 2054, 3804, 2397, 1344, 3125, 3779, 1698, 1265, 3923,
+		2174, 2863, 3582, 3291, 2694, 258, 3046, 1071, 3974, 1278, 2666, 200, 3667, 2821, 265, 3531,
+		999, 1978, 2775, 1205, 1880, 226, 3661, 2341, 1928, 827, 3094, 2140, 3243, 895, 3656, 2987
+	},
+	{
+		3998, 1907, 2623, 3429, 3960, 1231, 2016, 3839, 1615, 3526, 240, 2077, 3167, 2, 3561, 2703,
+		2226, 3658, 3037, 996, 2298, 1267, 2583, 58, 673, 2814, 441, 923, 2460, 601, 2667, 1832,
+		820, 29, 1370, 1987, 993, 3818, 2080, 588, 1752, 2431, 3332, 1533, 2261, 1190, 1632, 625,
+		3121, 4000, 383, 2426, 3873, 985, 3031, 1293, 154, 3770, 2422, 1181, 615, 1526, 2635, 496
+	},
+	{
+		836, 3206, 613, 1026, 1764, 33, 3028, 953, 536, 3099, 832, 2622, 4060, 2373, 869, 3302,
+		1223, 237, 1493, 512, 3552, 3295, 1761, 3089, 1196, 3535, 1950, 3688, 1421, 3014, 221, 3338,
+		2325, 3067, 4011, 2479, 636, 1588, 2586, 3593, 3139, 379, 998, 3928, 487, 3175, 3830, 2655,
+		2314, 1725, 822, 3328, 1454, 2235, 681, 2669, 3325, 1538, 461, 4080, 2819, 3510, 2006, 1268
+	},
+	{
+		2449, 1445, 3796, 2951, 2296, 3693, 2499, 3369, 1841, 2257, 3785, 1232, 556, 1531, 1827, 407,
+		2986, 3927, 2607, 2095, 2809, 204, 883, 4012, 2225, 1544, 3305, 307, 2189, 4092, 990, 3594,
+		511, 1603, 1103, 304, 2979, 3351, 122, 1374, 818, 2752, 2064, 2908, 1759, 800, 2008, 1093,
+		284, 1330, 3684, 2599, 87, 3174, 1730, 3973, 2107, 930, 2601, 1811, 119, 2267, 332, 3411
+	},
+	{
+		2874, 142, 2101, 369, 1290, 777, 1514, 208, 2830, 1407, 390, 1957, 3416, 2782, 3716, 2463,
+		2014, 1021, 1747, 759, 3841, 1375, 1981, 2719, 272, 979, 2575, 746, 2832, 1644, 2041, 1329,
+		2542, 3754, 2072, 3454, 1777, 1210, 2276, 4095, 1869, 3474, 13, 1261, 3385, 2486, 148, 3565,
+		3257, 2915, 2136, 654, 1925, 3548, 482, 1162, 255, 3057, 3533, 1230, 3163, 950, 3930, 1735
+	},
+	{
+		1073, 3649, 1692, 2615, 3146, 3460, 2158, 3979, 1069, 3628, 2398, 3006, 1033, 231, 1325, 678,
+		3361, 68, 3580, 2961, 426, 2459, 3459, 557, 3644, 3041, 1842, 3795, 1189, 176, 3153, 682,
+		2857, 137, 854, 2711, 3868, 707, 2911, 334, 2497, 1501, 3817, 2306, 409, 4041, 2804, 1475,
+		1836, 477, 1038, 4064, 2759, 1337, 2866, 2311, 3672, 1597, 593, 1974, 3748, 1489, 3013, 523
+	},
+	{
+		2675, 3285, 819, 3922, 566, 1886, 348, 2600, 686, 3272, 57, 1622, 3844, 2182, 2890, 3981,
+		1581, 2698, 1248, 2168, 1619, 3183, 1087, 1726, 2365, 1398, 46, 3186, 2447, 3505, 2244, 3951,
+		1843, 3300, 2394, 1338, 415, 1982, 3680, 1137, 3240, 537, 940, 2989, 1623, 1155, 2106, 858,
+		3756, 2388, 3458, 1649, 298, 907, 3888, 1875, 766, 2448, 2936, 218, 2640, 731, 2346, 2017
+	},
+	{
+		1369, 296, 2290, 1548, 1164, 2869, 3711, 1351, 1778, 2073, 2676, 837, 3231, 579, 1786, 986,
+		2318, 335, 3264, 4081, 931, 149, 3794, 2994, 778, 3976, 2127, 595, 1700, 948, 377, 1146,
+		1519, 494, 3576, 1697, 3180, 2628, 846, 2222, 1757, 2769, 3619, 1985, 710, 3698, 3108, 530,
+		2706, 74, 1258, 2995, 2178, 2510, 3345, 26, 3211, 1328, 4028, 2170, 1134, 3597, 42, 3838
+	},
+	{
+		645, 1929, 3085, 3528, 236, 2429, 811, 3064, 3437, 493, 4025, 1459, 2472, 3673, 139, 3120,
+		3603, 790, 1878, 577, 2403, 2758, 1938, 1317, 392, 2668, 3315, 1222, 3889, 2938, 2578, 3675,
+		3086, 2280, 1028, 4032, 190, 1273, 3486, 81, 3934, 1345, 241, 2535, 3357, 111, 2332, 1403,
+		3955, 2037, 3294, 755, 3805, 1486, 585, 1707, 2725, 957, 347, 3313, 1553, 3054, 1741, 3377
+	},
+	{
+		2894, 3945, 963, 2603, 2032, 4094, 1685, 97, 2354, 1204, 2909, 247, 2000, 1282, 2731, 2086,
+		1371, 2629, 3049, 3717, 1462, 3402, 297, 2321, 3584, 1006, 1822, 2483, 326, 2058, 720, 1879,
+		6, 2772, 714, 2133, 2929, 2400, 1600, 3036, 657, 2420, 3228, 1234, 1765, 2747, 1063, 3501,
+		1680, 357, 2568, 1806, 171, 3106, 1067, 3700, 2146, 3813, 1910, 2789, 486, 879, 2573, 1180
+	},
+	{
+		2380, 1626, 165, 1420, 696, 2965, 1274, 3553, 921, 3755, 1753, 3199, 954, 3448, 642, 3957,
+		419, 1716, 1001, 19, 2120, 1079, 3948, 2834, 1541, 3058, 129, 3420, 1560, 3604, 3213, 1409,
+		3811, 1216, 3473, 1833, 349, 3802, 1010, 2065, 3600, 1867, 861, 3985, 309, 3751, 1969, 728,
+		3029, 1019, 3701, 1211, 2773, 1952, 3443, 2443, 203, 1446, 666, 3532, 2273, 3991, 1958, 372
+	},
+	{
+		841, 3418, 2796, 3766, 3248, 424, 1889, 2247, 2810, 647, 2533, 396, 3869, 2242, 1637, 1129,
+		3235, 3782, 2471, 2871, 3221, 553, 1740, 840, 473, 2097, 4072, 890, 2802, 1122, 211, 2386,
+		2974, 436, 2610, 1453, 3348, 592, 2755, 281, 1448, 2897, 469, 2263, 1550, 2934, 450, 2631,
+		2195, 3419, 551, 2291, 4021, 452, 1381, 721, 2887, 3406, 2559, 1185, 1645, 103, 3210, 3710
+	},
+	{
+		2175, 540, 1772, 2117, 1132, 2393, 3892, 185, 1566, 3337, 2114, 1441, 2770, 50, 3025, 2570,
+		217, 2207, 627, 1225, 1900, 3640, 2270, 3274, 3764, 2562, 1332, 547, 2305, 1784, 3913, 775,
+		1664, 2039, 3982, 813, 3074, 1750, 2340, 4082, 3157, 1088, 2627, 3326, 980, 3478, 1334, 4049,
+		45, 1415, 2860, 1625, 886, 3034, 2108, 3912, 970, 1787, 370, 2980, 3651, 1030, 2722, 1395
+	},
+	{
+		3043, 4013, 995, 14, 2746, 3432, 871, 3159, 1186, 3997, 518, 1107, 3387, 1825, 885, 3529,
+		1975, 1465, 3444, 4023, 330, 2705, 1384, 83, 1115, 1883, 2928, 3686, 3123, 391, 2604, 3246,
+		1039, 3536, 88, 2234, 1123, 3659, 1310, 785, 2177, 5, 3823, 2007, 631, 2399, 1850, 889,
+		3145, 2084, 3834, 253, 2587, 3513, 56, 1577, 3224, 2364, 3788, 2031, 749, 2470, 1780, 257
+	},
+	{
+		1213, 2401, 2935, 3629, 1400, 531, 1682, 2569, 343, 1809, 2865, 3602, 2423, 653, 4083, 1304,
+		468, 2956, 934, 2317, 1646, 881, 3118, 2509, 3491, 745, 229, 1536, 2015, 1245, 3507, 2152,
+		497, 2534, 1385, 2845, 464, 2546, 182, 3383, 1799, 3508, 1288, 1650, 3107, 163, 3613, 2556,
+		1652, 643, 1110, 3219, 1854, 1250, 2274, 2765, 542, 1156, 144, 1439, 3158, 503, 3781, 3399
+	},
+	{
+		702, 1604, 363, 1838, 2316, 3833, 2068, 2972, 3641, 2205, 914, 168, 1530, 3140, 2265, 2764,
+		3727, 1743, 3266, 116, 2840, 3878, 501, 2055, 1579, 3963, 2677, 3299, 912, 4007, 145, 1473,
+		3033, 3825, 1873, 3225, 3920, 1983, 3027, 1484, 2818, 690, 2566, 360, 3968, 2854, 1242, 399,
+		3386, 2697, 3635, 2351, 499, 3867, 803, 3608, 1979, 3967, 2855, 3521, 2184, 1130, 2806, 1991
+	},
+	{
+		2557, 3848, 3334, 802, 3072, 210, 1099, 723, 1352, 3196, 2644, 3916, 1993, 435, 1114, 187,
+		2112, 674, 2565, 1394, 3539, 1862, 1237, 3238, 319, 2327, 1172, 2159, 598, 2496, 2831, 1918,
+		716, 1199, 193, 900, 1583, 574, 1070, 3881, 285, 2277, 3723, 1027, 2059, 735, 2227, 3905,
+		1954, 219, 1524, 902, 2931, 1724, 3277, 283, 1349, 2416, 901, 1721, 269, 4084, 1529, 158
+	},
+	{
+		3141, 1074, 2074, 2664, 1276, 3519, 2442, 4059, 48, 1661, 578, 1220, 3366, 2924, 3849, 1585,
+		3484, 1171, 3972, 397, 2192, 727, 2653, 3783, 943, 2996, 3726, 1, 3451, 1627, 1015, 3340,
+		3689, 2223, 2723, 3415, 2374, 3566, 2649, 2118, 893, 3047, 1848, 3312, 2760, 1589, 3212, 946,
+		1355, 2988, 2179, 4076, 132, 2514, 1121, 3048, 1671, 3400, 602, 2689, 3306, 2435, 927, 3610
+	},
+	{
+		584, 1500, 95, 3938, 572, 1546, 2856, 1855, 3396, 2145, 3737, 2372, 781, 1763, 2531, 576,
+		2312, 2870, 1790, 3070, 1047, 3379, 77, 2233, 1795, 532, 1460, 1865, 2898, 3760, 274, 2389,
+		444, 1710, 3987, 344, 1327, 3129, 63, 1689, 3615, 1200, 479, 1428, 136, 3750, 485, 2491,
+		3572, 698, 3329, 1219, 1941, 3742, 665, 2132, 2646, 67, 3767, 1311, 1930, 471, 3010, 2171
+	},
+	{
+		2781, 3496, 2414, 1748, 3152, 2197, 892, 453, 2630, 1029, 266, 2799, 1408, 82, 3638, 971,
+		3314, 141, 809, 2434, 3847, 1636, 2937, 1373, 3462, 2594, 3218, 2378, 761, 1289, 2082, 3117,
+		1423, 2967, 1065, 2042, 750, 1835, 3941, 664, 2407, 3388, 2665, 4065, 850, 2289, 1899, 2816,
+		4, 1792, 2430, 371, 2774, 1492, 3449, 425, 4031, 1012, 2199, 2943, 804, 3876, 1634, 1188
+	},
+	{
+		1915, 305, 3002, 982, 3676, 227, 3286, 3789, 1391, 3100, 3487, 1934, 3990, 3150, 2045, 2741,
+		1482, 1960, 3691, 1416, 282, 2081, 591, 4073, 845, 251, 1094, 3910, 404, 2693, 4024, 880,
+		3577, 639, 2477, 3320, 2879, 2259, 1126, 2790, 1515, 301, 2154, 1677, 3003, 1147, 3401, 1447,
+		3992, 1101, 3650, 3185, 924, 2246, 2893, 1279, 1851, 3170, 1543, 355, 3427, 2375, 47, 3692
+	},
+	{
+		870, 4048, 1366, 528, 1995, 2595, 1233, 1803, 2323, 651, 1606, 941, 345, 2440, 1247, 418,
+		4050, 3020, 559, 3467, 2726, 3207, 1169, 2421, 2822, 3646, 2126, 1412, 3430, 1828, 186, 1684,
+		2620, 36, 3776, 1545, 250, 3446, 484, 3762, 3084, 964, 3687, 606, 2501, 3633, 359, 779,
+		3076, 2129, 594, 1694, 3908, 85, 791, 3592, 2465, 206, 3705, 2596, 1818, 988, 3267, 2551
+	},
+	{
+		1582, 3223, 2188, 2837, 1510, 3984, 694, 2884, 107, 3931, 2526, 2970, 3527, 717, 1715, 3395,
+		877, 2493, 1198, 2228, 919, 1830, 3696, 133, 1943, 1559, 618, 3004, 2304, 1005, 2919, 3356,
+		1308, 2241, 1898, 956, 4085, 1405, 2553, 1742, 162, 1989, 1244, 3252, 80, 1856, 2727, 1629,
+		2468, 291, 2916, 1342, 2619, 1935, 3135, 1594, 609, 2838, 1192, 677, 4006, 1389, 2110, 626
+	},
+	{
+		2716, 353, 1096, 3538, 12, 2297, 3372, 1054, 3568, 2046, 462, 1133, 2131, 2827, 3866, 2286,
+		233, 1820, 2914, 53, 3933, 491, 1488, 2959, 1022, 3408, 2624, 214, 3730, 545, 2061, 3864,
+		752, 2852, 3249, 550, 2660, 2134, 806, 3244, 2353, 4003, 2813, 2201, 1383, 3959, 1017, 3203,
+		3821, 1194, 3472, 2320, 333, 3668, 1152, 2347, 3950, 1976, 3376, 2295, 3026, 420, 2878, 3820
+	},
+	{
+		1849, 2338, 3871, 739, 3109, 1703, 381, 1919, 2611, 1335, 3214, 3797, 1513, 18, 1020, 3168,
+		1399, 3735, 3350, 1595, 2663, 2098, 3304, 2284, 385, 3793, 1733, 1212, 3202, 1522, 2505, 1168,
+		402, 1643, 3671, 1203, 3075, 102, 3605, 1178, 562, 1574, 367, 866, 3434, 2390, 620, 2062,
+		173, 1903, 706, 3980, 958, 2983, 488, 3494, 273, 994, 1517, 101, 1712, 3492, 1206, 189
+	},
+	{
+		933, 3336, 1425, 1951, 2641, 1221, 3845, 2960, 769, 259, 1732, 2342, 605, 3663, 1946, 2753,
+		705, 2151, 406, 984, 3617, 718, 1260, 4001, 798, 3082, 2444, 724, 1961, 4057, 106, 3091,
+		3470, 2438, 196, 2044, 1570, 3890, 1897, 2885, 3480, 2515, 3784, 2969, 1663, 413, 2880, 3648,
+		1502, 3364, 2745, 1433, 2153, 1737, 2662, 1392, 2204, 3122, 2544, 3631, 916, 2030, 2475, 3612
+	},
+	{
+		3001, 520, 2777, 175, 3428, 894, 2417, 1505, 3303, 4074, 2720, 903, 3380, 2513, 1586, 361,
+		3909, 2525, 1298, 3039, 1857, 2446, 160, 2749, 1457, 2070, 17, 2876, 3520, 920, 2682, 1794,
+		2166, 939, 3812, 2800, 765, 2457, 393, 1469, 915, 1955, 1161, 195, 2093, 3898, 1271, 2520,
+		874, 2238, 417, 3192, 73, 3736, 744, 3273, 1815, 695, 3827, 502, 2776, 3227, 689, 1540
+	},
+	{
+		3801, 1758, 1116, 4035, 2103, 548, 3589, 143, 2162, 1120, 1994, 3061, 180, 1263, 2946, 3495,
+		1111, 1769, 2779, 4086, 299, 3511, 3173, 1744, 3455, 1080, 3900, 1499, 2301, 515, 1361, 3627,
+		619, 1471, 3179, 470, 3488, 1053, 3226, 2654, 8, 3087, 3567, 2427, 3341, 756, 1888, 51,
+		3500, 2955, 1127, 1852, 3439, 2502, 1224, 4088, 124, 2889, 1149, 1971, 1372, 4043, 40, 2194
+	},
+	{
+		2577, 261, 3131, 2376, 1470, 3021, 1779, 2768, 693, 3719, 475, 1614, 3787, 2057, 812, 2248,
+		121, 3263, 509, 853, 1555, 2157, 969, 445, 2549, 635, 3124, 339, 1861, 3355, 2859, 315,
+		3965, 2561, 1901, 1277, 2288, 1788, 4026, 2149, 3732, 733, 1561, 504, 1406, 2614, 3176, 3798,
+		1641, 534, 4022, 2377, 898, 1598, 456, 2738, 2309, 1551, 3457, 2428, 388, 1821, 2947, 1255
+	},
+	{
+		3421, 2010, 599, 3546, 944, 279, 3940, 1313, 2334, 2954, 1362, 3441, 2650, 434, 4030, 3092,
+		1474, 3743, 1966, 2355, 3792, 1251, 2926, 3937, 2212, 3558, 1197, 2506, 3828, 1024, 1719, 2387,
+		1166, 2944, 91, 3885, 2718, 245, 655, 1177, 1717, 2828, 2200, 4093, 2948, 1009, 308, 1193,
+		2128, 2648, 1378, 271, 3065, 3836, 2038, 3540, 831, 3193, 254, 3877, 2729, 1000, 3695, 789
+	},
+	{
+		1620, 3891, 1292, 2817, 1863, 2527, 3215, 997, 3530, 41, 1932, 859, 2308, 1144, 1711, 629,
+		2492, 991, 2891, 3365, 37, 2582, 711, 1896, 126, 1617, 2833, 2078, 685, 3059, 159, 3431,
+		2122, 899, 3569, 725, 1631, 2984, 3547, 2593, 328, 3368, 961, 153, 1970, 3489, 2322, 2903,
+		760, 3324, 3712, 1948, 641, 2792, 1153, 289, 1834, 1091, 2142, 753, 1487, 3318, 2371, 465
+	},
+	{
+		3236, 860, 2224, 55, 3791, 708, 2094, 337, 1660, 2522, 3995, 3022, 228, 3297, 2730, 3550,
+		1924, 331, 1341, 600, 1683, 3142, 3645, 1418, 3354, 922, 4042, 262, 1376, 2634, 3773, 1496,
+		508, 3198, 1404, 2036, 3287, 992, 1468, 2079, 3865, 1307, 2485, 3725, 1638, 596, 1461, 3964,
+		1814, 183, 1051, 2480, 3574, 1466, 2278, 2999, 3936, 2616, 3665, 3060, 1922, 224, 2056, 2784
+	},
+	{
+		179, 2540, 3071, 1675, 3279, 1356, 3704, 2761, 3136, 1173, 590, 1572, 3815, 2021, 1323, 66,
+		3011, 3946, 2638, 3724, 2050, 1062, 313, 2243, 2750, 546, 3171, 1729, 3636, 2252, 796, 1937,
+		4061, 2681, 2330, 311, 3747, 2473, 65, 3222, 558, 1812, 3044, 782, 3301, 2742, 3581, 405,
+		2563, 3007, 1576, 3188, 25, 851, 3425, 560, 1535, 157, 1316, 519, 3556, 1078, 3943, 1358
+	},
+	{
+		1845, 1139, 4055, 410, 1066, 2464, 478, 1839, 774, 3625, 2141, 2798, 354, 910, 3652, 2385,
+		1068, 1613, 2211, 876, 3481, 2450, 3018, 3774, 1243, 1945, 2412, 1064, 3316, 380, 1252, 2975,
+		76, 1705, 1105, 2882, 607, 1798, 3983, 843, 2788, 2218, 238, 1227, 2144, 39, 1092, 2076,
+		1283, 3852, 539, 2176, 1749, 4036, 2576, 2001, 3317, 2256, 2883, 1714, 2555, 2993, 668, 3382
+	},
+	{
+		3728, 555, 2843, 2004, 3591, 2942, 1528, 3947, 2319, 164, 3389, 1348, 2456, 3162, 1669, 700,
+		3362, 474, 3155, 147, 1472, 526, 1723, 838, 243, 3879, 2998, 31, 2684, 2012, 3571, 2504,
+		3307, 816, 3880, 3384, 1270, 2239, 2643, 1154, 1547, 3822, 3239, 2617, 4004, 1736, 3102, 740,
+		3352, 2336, 909, 3616, 2734, 1315, 365, 1044, 3826, 652, 966, 4058, 11, 2302, 1599, 2169
+	},
+	{
+		3095, 2413, 1557, 828, 2236, 93, 918, 3310, 1287, 2877, 945, 1817, 3744, 449, 2115, 4019,
+		2661, 1207, 3790, 1908, 2958, 4066, 2699, 3464, 2165, 1618, 734, 1479, 4002, 612, 1648, 1075,
+		500, 2379, 1874, 192, 1573, 3620, 256, 3012, 3493, 423, 937, 1476, 616, 2361, 3707, 2680,
+		1564, 117, 2927, 1167, 249, 3290, 1872, 2933, 1426, 2484, 3208, 2043, 1297, 3456, 414, 936
+	},
+	{
+		98, 1302, 3499, 295, 3181, 3809, 1927, 2679, 356, 2053, 4075, 667, 2690, 1163, 2962, 140,
+		1776, 2245, 2785, 614, 1097, 2023, 374, 1357, 3261, 2652, 3681, 2329, 973, 3138, 2803, 3904,
+		1494, 3639, 3035, 2686, 764, 3230, 1973, 637, 1754, 2419, 2009, 3653, 2900, 270, 1354, 481,
+		4062, 1840, 3468, 2052, 3899, 2408, 763, 3708, 110, 1783, 375, 3733, 688, 2805, 3907, 2585
+	},
+	{
+		3269, 1926, 3921, 2612, 1718, 1208, 2411, 634, 3683, 1435, 3052, 24, 2180, 3292, 1521, 960,
+		3469, 318, 1430, 3258, 2368, 3557, 904, 2433, 123, 1119, 411, 3404, 1801, 188, 2213, 322,
+		2028, 926, 398, 2193, 3856, 1034, 2451, 4077, 1281, 2801, 94, 3370, 1100, 1887, 3278, 2249,
+		1042, 2572, 722, 1443, 492, 1590, 3113, 2164, 2678, 3549, 3032, 1048, 2437, 1485, 1837, 1143
+	},
+	{
+		751, 2294, 524, 975, 3019, 451, 3442, 1592, 3197, 1002, 2552, 1655, 3578, 771, 3832, 1992,
+		2528, 3929, 817, 3679, 3, 1676, 3083, 3901, 1877, 2904, 2089, 1343, 2532, 3810, 1285, 3424,
+		2625, 3204, 1319, 1708, 16, 2786, 1464, 306, 3154, 3721, 741, 1624, 2567, 3799, 814, 2862,
+		3562, 340, 3247, 2232, 2707, 3777, 1032, 422, 1272, 638, 1575, 1990, 3344, 167, 2990, 3674
+	},
+	{
+		1673, 2794, 3373, 1504, 2019, 4020, 897, 2835, 234, 2209, 3895, 483, 1246, 2395, 275, 2823,
+		543, 1647, 3045, 2067, 1187, 2637, 621, 1490, 3512, 675, 3952, 3156, 575, 888, 3005, 1672,
+		669, 4047, 2406, 3518, 3080, 1917, 3381, 857, 2102, 1138, 2282, 3066, 506, 2143, 59, 1587,
+		2003, 1364, 3939, 1117, 2982, 49, 1963, 3256, 4033, 2300, 2849, 300, 3962, 906, 2191, 440
+	},
+	{
+		4067, 1266, 302, 3734, 2538, 69, 2303, 1804, 3775, 704, 1895, 3360, 2744, 1793, 3190, 1326,
+		3398, 1090, 2467, 439, 2892, 3772, 2253, 260, 2701, 1003, 1658, 151, 2740, 1911, 3545, 64,
+		1125, 1868, 443, 847, 1214, 581, 3883, 1679, 2656, 174, 3954, 1365, 3438, 1008, 3978, 3177,
+		650, 2658, 184, 1766, 849, 3514, 1377, 2602, 1681, 887, 3590, 1226, 2647, 1438, 3453, 2571
+	},
+	{
+		32, 3149, 2208, 784, 2941, 1386, 3599, 1098, 2659, 1363, 2976, 1059, 109, 3999, 663, 2215,
+		3803, 96, 1913, 4027, 1458, 967, 1939, 3229, 1320, 2370, 3435, 2121, 3660, 1215, 2345, 2836,
+		2173, 3614, 2991, 2674, 3759, 2255, 2560, 447, 3543, 2981, 1902, 351, 2783, 1706, 2508, 1218,
+		3699, 2283, 3126, 3630, 2474, 2111, 670, 3718, 199, 3069, 513, 2125, 3134, 608, 1844, 1052
+	},
+	{
+		2005, 1552, 3542, 1157, 1881, 362, 3283, 570, 3137, 191, 2358, 3702, 2130, 1503, 2949, 974,
+		1774, 2691, 3471, 747, 3132, 166, 3551, 589, 4087, 336, 2971, 738, 1507, 316, 3996, 538,
+		3276, 1390, 215, 1591, 2011, 118, 1387, 3172, 1036, 1495, 2452, 855, 3626, 2254, 205, 2997,
+		431, 1860, 754, 1506, 389, 3233, 2886, 1128, 1882, 2524, 1478, 3863, 161, 2392, 3715, 2888
+	},
+	{
+		3835, 2425, 568, 3063, 3778, 2584, 2219, 1542, 2013, 4014, 1635, 872, 386, 3339, 2500, 239,
+		3265, 573, 1269, 2221, 1709, 2756, 2476, 1527, 2844, 1853, 1145, 3860, 2564, 3053, 1045, 1756,
+		830, 2521, 3949, 1014, 3319, 2939, 834, 4039, 2071, 624, 3829, 3187, 1301, 659, 3407, 1532,
+		987, 3850, 2858, 1174, 4053, 1699, 287, 2344, 3958, 3275, 1049, 1933, 3475, 1612, 863, 466
+	},
+	{
+		1350, 935, 2710, 152, 1653, 726, 3914, 959, 3433, 480, 2545, 3068, 3583, 1086, 1947, 3739,
+		1539, 2381, 2977, 3654, 401, 3872, 1160, 2139, 865, 3330, 2333, 104, 1893, 3405, 2138, 2732,
+		3769, 421, 1904, 2357, 662, 3670, 1739, 2404, 209, 2829, 1767, 10, 2085, 4078, 1826, 2709,
+		2216, 3254, 78, 2063, 2737, 632, 3585, 1419, 795, 34, 2748, 730, 2930, 1209, 2590, 3346
+	},
+	{
+		3024, 1797, 4010, 2109, 3417, 1262, 2921, 84, 2671, 1312, 691, 1800, 2736, 1397, 476, 2847,
+		799, 3966, 134, 1060, 2002, 758, 3397, 61, 3819, 527, 1621, 3607, 911, 580, 1422, 135,
+		3103, 1240, 3422, 2867, 1525, 454, 2695, 1183, 3349, 3714, 1058, 2642, 3077, 884, 263, 3609,
+		564, 1353, 2482, 3509, 905, 1905, 2608, 3358, 2172, 1720, 3808, 2262, 276, 4040, 2096, 128
+	},
+	{
+		2287, 378, 3271, 1082, 521, 2478, 1912, 3622, 2148, 3151, 3857, 2285, 27, 4068, 2231, 3390,
+		1217, 2088, 1686, 2815, 3251, 1509, 2331, 2895, 1771, 2606, 3194, 1309, 2923, 3942, 2352, 3657,
+		1678, 2186, 878, 30, 3559, 1977, 3816, 321, 2210, 1563, 571, 3515, 1401, 2293, 2907, 1106,
+		1980, 3970, 341, 1567, 3160, 3893, 222, 1018, 2964, 549, 3423, 1380, 3114, 1702, 692, 3685
+	},
+	{
+		1497, 801, 2547, 1596, 3694, 3090, 364, 1667, 1077, 290, 1558, 981, 3209, 644, 1665, 2580,
+		280, 3101, 3560, 514, 2529, 4017, 314, 1202, 3682, 929, 327, 2454, 1968, 246, 2793, 1007,
+		611, 2645, 4089, 1339, 2554, 989, 3115, 1424, 762, 3241, 2469, 1984, 368, 3902, 1654, 3343,
+		2609, 821, 3056, 2240, 489, 1321, 2405, 1807, 3738, 1256, 2415, 400, 2040, 1013, 3216, 2739
+	},
+	{
+		1118, 3858, 2917, 202, 2187, 1347, 810, 3993, 2797, 3502, 2512, 3745, 2033, 2868, 1057, 3840,
+		736, 1463, 2268, 949, 1306, 1870, 699, 3164, 2060, 1456, 4046, 712, 3440, 1165, 1816, 3165,
+		3490, 235, 3038, 1746, 3284, 617, 2313, 2842, 4016, 1785, 198, 3761, 1201, 2537, 715, 127,
+		1450, 3757, 1846, 1135, 3655, 2945, 703, 3255, 105, 2692, 844, 3624, 2626, 3886, 463, 1914
+	},
+	{
+		23, 3322, 1972, 676, 3918, 2721, 3342, 2343, 582, 1923, 805, 223, 1333, 3647, 155, 1906,
+		3465, 2754, 3944, 35, 3669, 2696, 3436, 2366, 216, 2767, 3062, 2160, 1568, 3882, 432, 2214,
+		1436, 1986, 743, 2418, 288, 3870, 1657, 86, 1104, 2613, 3042, 839, 3298, 1859, 3678, 3016,
+		2272, 525, 2751, 22, 2523, 1696, 2105, 3926, 1480, 1965, 3205, 1659, 156, 1437, 2307, 3563
+	},
+	{
+		1610, 2402, 1305, 3525, 1770, 1016, 52, 1537, 3104, 1284, 3378, 2700, 1734, 2396, 3079, 2202,
+		1142, 448, 1775, 2968, 2150, 373, 1593, 852, 3621, 1831, 1085, 0, 3245, 2488, 862, 3666,
+		2591, 3854, 1056, 3564, 2092, 1257, 3450, 2022, 3642, 533, 1360, 2147, 2795, 498, 1076, 1996,
+		3555, 1280, 3220, 4069, 938, 3392, 317, 1084, 2850, 633, 4018, 1055, 2978, 3367, 787, 2873
+	}
+};
+
+// The error diffusion runs in parallel over bands of rows, every band first diffuses a few rows above it
+static const uint32_t DIFFUSION_BAND_ROWS = 64;
+static const uint32_t DIFFUSION_WARMUP_ROWS = 8;
+
+static std::vector<float> generate_blue_noise_thresholds(uint32_t size)
+{
+	std::vector<float> thresholds(size * size);
+	for (uint32_t y = 0; y < size; ++y)
+		for (uint32_t x = 0; x < size; ++x)
+			thresholds[y * size + x] = (BLUE_NOISE_RANKS[y % 64][x % 64] + .5f) / (64.f * 64.f);
+	return thresholds;
+}
+
+static std::vector<float> generate_bayer_thresholds(uint32_t size)
+{
+	std::vector<float> thresholds(size * size);
+	for (uint32_t y = 0; y < size; ++y)
+		for (uint32_t x = 0; x < size; ++x)
+			thresholds[y * size + x] = (BAYER_MATRIX[y % 8][x % 8] + .5f) / 64.f;
+	return thresholds;
+}
+
+// Row of thresholds added to the scaled texels before truncating them, one per column modulo THRESHOLD_MAP_SIZE
+static const float* threshold_row(dither_mode mode, uint32_t y)
+{
+	static const std::vector<float> rounding(THRESHOLD_MAP_SIZE, .5f);
+	static const std::vector<float> bayer = generate_bayer_thresholds(THRESHOLD_MAP_SIZE);
+
+	switch (mode)
+	{
+		case dither_mode::BAYER:
+			return bayer.data() + (y % THRESHOLD_MAP_SIZE) * THRESHOLD_MAP_SIZE;
+
+		case dither_mode::BLUE_NOISE:
+		{
+			static const std::vector<float> blue_noise = generate_blue_noise_thresholds(THRESHOLD_MAP_SIZE);
+			return blue_noise.data() + (y % THRESHOLD_MAP_SIZE) * THRESHOLD_MAP_SIZE;
+		}
+
+		default:
+			return rounding.data();
+	}
+}
+
+#if defined(__AVX2__)
+static void store_quantized(uint8_t* out, __m256i values)
+{
+	const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(words, words));
+}
+
+static void store_quantized(uint16_t* out, __m256i values)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1)));
+}
+#endif
+
+// Quantizes count texels starting at column x, which must be a multiple of 8 so the thresholds never wrap within a vector
+template<typename T>
+static void quantize_row(const float* values, T* out, uint32_t count, const float* thresholds, uint32_t x)
 {
-	return async_apply(invert_helper, std::ref(image));
+	assert(x % 8 == 0);
+	const float max_value = static_cast<float>(std::numeric_limits<T>::max());
+	uint32_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 scale = _mm256_set1_ps(max_value);
+	const __m256i max_quantized = _mm256_set1_epi32(std::numeric_limits<T>::max());
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + i), zero), one);
+		const __m256 threshold = _mm256_loadu_ps(thresholds + (x + i) % THRESHOLD_MAP_SIZE);
+		const __m256i quantized = _mm256_cvttps_epi32(_mm256_fmadd_ps(value, scale, threshold));
+		store_quantized(out + i, _mm256_min_epi32(quantized, max_quantized));
+	}
+#endif
+
+	for (; i < count; ++i)
+		out[i] = static_cast<T>(std::min(saturate(values[i]) * max_value + thresholds[(x + i) % THRESHOLD_MAP_SIZE], max_value));
 }
 
-static void gaussian_blur_helper(image_f32& image, uint32_t num_pass, uint32_t kernel_size, float sigma, std::promise<void> promise)
+// Serpentine Floyd-Steinberg, the direction of a row depends on its parity so the bands agree on it
+template<typename T>
+static void diffuse_errors(const image_f32& image, T* out)
 {
 	const uint32_t h = image.height();
 	const uint32_t w = image.width();
+	const float max_value = static_cast<float>(std::numeric_limits<T>::max());
 
-	image_f32 temp(w, h);
-	const int32_t kernel_half_width = static_cast<int32_t>(kernel_size) / 2;
+	/* NOTE(Corralx): The error of a row depends on every row above it, so the bands would restart from no error and
+	   show a seam, diffusing a few rows above the band first brings the errors to the same statistics at a small cost */
+	const uint32_t num_bands = (h + DIFFUSION_BAND_ROWS - 1) / DIFFUSION_BAND_ROWS;
+	task_scheduler::instance().parallel_for(num_bands, [&](uint32_t band)
+	{
+		const uint32_t first_row = band * DIFFUSION_BAND_ROWS;
+		const uint32_t last_row = std::min(first_row + DIFFUSION_BAND_ROWS, h);
 
-	const std::vector<float> gaussian_kernel = generate_gaussian_kernel_1d(sigma, kernel_size);
+		// Padded by one texel on both sides, so the neighbours of the edges need no test
+		std::vector<float> errors(w + 2, .0f);
+		std::vector<float> next_errors(w + 2, .0f);
+		for (uint32_t y = first_row - std::min(first_row, DIFFUSION_WARMUP_ROWS); y < last_row; ++y)
+		{
+			const bool reverse = (y & 1) != 0;
+			const int32_t step = reverse ? -1 : 1;
+			const float* row = image.raw() + static_cast<size_t>(y) * w;
+			std::fill(next_errors.begin(), next_errors.end(), .0f);
 
-	for (uint32_t pass = 0; pass < num_pass; ++pass)
+			for (uint32_t k = 0; k < w; ++k)
+			{
+				const uint32_t x = reverse ? w - 1 - k : k;
+				const int64_t e = static_cast<int64_t>(x) + 1;
+				const float value = saturate(row[x]) * max_value + errors[e];
+				const float quantized = clamp(std::floor(value + .5f), .0f, max_value);
+				const float error = value - quantized;
+
+				if (y >= first_row)
+					out[static_cast<size_t>(y) * w + x] = static_cast<T>(quantized);
+
+				errors[e + step] += error * (7.f / 16.f);
+				next_errors[e - step] += error * (3.f / 16.f);
+				next_errors[e] += error * (5.f / 16.f);
+				next_errors[e + step] += error * (1.f / 16.f);
+			}
+
+			errors.swap(next_errors);
+		}
+	});
+}
+
+// Destination of the last sweep of a pipeline, the texels are quantized with an ordered dither while stored
+struct quantized_output
+{
+	dither_mode mode;
+	uint8_t* u8;
+	uint16_t* u16;
+
+	void store(const float* values, uint32_t x, uint32_t y, size_t offset, uint32_t count) const
+	{
+		const float* thresholds = threshold_row(mode, y);
+		if (u8)
+			quantize_row(values, u8 + offset, count, thresholds, x);
+		else
+			quantize_row(values, u16 + offset, count, thresholds, x);
+	}
+};
+
+static bool is_point_op(postprocess_op op)
+{
+	return op == postprocess_op::INVERT;
+}
+
+// Applies the point stages in order to count texels
+static void apply_point_ops(const std::vector<postprocess_op>& ops, float* values, uint32_t count)
+{
+	for (postprocess_op op : ops)
 	{
-		// First pass: blur horizontally
-		for (uint32_t i = 0; i < h; ++i)
+		switch (op)
 		{
-			for (uint32_t j = 0; j < w; ++j)
+			case postprocess_op::INVERT:
+				for (uint32_t i = 0; i < count; ++i)
+					values[i] = saturate(1.f - values[i]);
+				break;
+
+			default:
+				assert(false);
+		}
+	}
+}
+
+// Applies the point stages to the image in place, or while converting it to the output if any
+static void point_texels(image_f32& image, const std::vector<postprocess_op>& ops, const quantized_output* output)
+{
+	if (ops.empty() && !output)
+		return;
+
+	const uint32_t h = image.height();
+	const uint32_t w = image.width();
+
+	parallel_ranges(h, [&](uint32_t first_row, uint32_t last_row)
+	{
+		std::vector<float> quantized_row(output ? w : 0);
+		for (uint32_t i = first_row; i < last_row; ++i)
+		{
+			float* row = image.raw() + static_cast<size_t>(i) * w;
+			if (output)
 			{
-				float sum = .0f;
-				for (int32_t k = -kernel_half_width; k <= kernel_half_width; ++k)
-				{
-					const uint32_t sample_j = clamp(j + k, (uint32_t)0, w - 1);
-					const uint32_t index = i * w + sample_j;
-					sum += image[index] * gaussian_kernel[k + kernel_half_width];
-				}
+				std::copy(row, row + w, quantized_row.begin());
+				row = quantized_row.data();
+			}
 
-				const uint32_t index = i * w + j;
-				temp[index] = sum;
+			apply_point_ops(ops, row, w);
+			if (output)
+				output->store(row, 0, i, static_cast<size_t>(i) * w, w);
+		}
+	});
+}
+
+// Blurs a band of rows num_pass times, clamping to the first and last row of the band after every pass
+// The band holds rows * columns values and is replaced by the result
+static void clamped_passes(std::vector<float>& band, uint32_t rows, uint32_t columns, const std::vector<float>& kernel, uint32_t num_pass)
+{
+	const uint32_t taps = static_cast<uint32_t>(kernel.size());
+	const uint32_t radius = taps / 2;
+
+	std::vector<float> blurred(band.size());
+	std::vector<const float*> sources(taps);
+	for (uint32_t pass = 0; pass < num_pass; ++pass)
+	{
+		for (uint32_t i = 0; i < rows; ++i)
+		{
+			for (uint32_t t = 0; t < taps; ++t)
+			{
+				const int64_t sample_i = clamp(static_cast<int64_t>(i) + t - radius, static_cast<int64_t>(0), static_cast<int64_t>(rows) - 1);
+				sources[t] = band.data() + sample_i * columns;
 			}
+
+			weighted_sum(sources.data(), kernel.data(), taps, blurred.data() + static_cast<size_t>(i) * columns, columns);
+		}
+		band.swap(blurred);
+	}
+}
+
+// The point stages before the blur are applied while loading the rows, the ones after it before storing them
+static void gaussian_texels(image_f32& image, uint32_t num_pass, uint32_t kernel_size, float sigma,
+							const std::vector<postprocess_op>& before, const std::vector<postprocess_op>& after, const quantized_output* output)
+{
+	assert(kernel_size > 0);
+	if (num_pass == 0)
+	{
+		std::vector<postprocess_op> ops = before;
+		ops.insert(ops.end(), after.begin(), after.end());
+		point_texels(image, ops, output);
+		return;
+	}
+
+	const uint32_t h = image.height();
+	const uint32_t w = image.width();
+
+	/* NOTE(Corralx): The blur is separable and the horizontal and vertical passes commute, so the passes are fused
+	   in a single pass of the kernel convolved num_pass times with itself, which is identical away from the borders
+	   Within radius texels of a border the passes clamp the edge one after the other, so those texels are blurred
+	   again pass by pass from the 2 * radius texels next to the border, the farthest ones any clamp can reach */
+	const std::vector<float> gaussian_kernel = generate_gaussian_kernel_1d(sigma, kernel_size);
+	std::vector<float> kernel = gaussian_kernel;
+	for (uint32_t pass = 1; pass < num_pass; ++pass)
+	{
+		std::vector<float> fused(kernel.size() + kernel_size - 1, .0f);
+		for (size_t i = 0; i < kernel.size(); ++i)
+			for (uint32_t k = 0; k < kernel_size; ++k)
+				fused[i + k] += kernel[i] * gaussian_kernel[k];
+		kernel.swap(fused);
+	}
+
+	const uint32_t taps = static_cast<uint32_t>(kernel.size());
+	const uint32_t radius = num_pass * (kernel_size / 2);
+	const uint32_t band_columns = std::min(w, 2 * radius);
+	const uint32_t band_rows = std::min(h, 2 * radius);
+
+	image_f32 temp(w, h);
+
+	// First pass: blur horizontally, every row is padded with its edge values so the taps never leave it
+	parallel_ranges(h, [&](uint32_t first_row, uint32_t last_row)
+	{
+		std::vector<float> padded(w + taps - 1);
+		std::vector<const float*> sources(taps);
+		for (uint32_t t = 0; t < taps; ++t)
+			sources[t] = padded.data() + t;
+
+		std::vector<float> band;
+		for (uint32_t i = first_row; i < last_row; ++i)
+		{
+			const float* row = image.raw() + static_cast<size_t>(i) * w;
+			std::copy(row, row + w, padded.begin() + radius);
+			apply_point_ops(before, padded.data() + radius, w);
+			std::fill_n(padded.begin(), radius, padded[radius]);
+			std::fill(padded.begin() + radius + w, padded.end(), padded[radius + w - 1]);
+
+			float* out = temp.raw() + static_cast<size_t>(i) * w;
+			weighted_sum(sources.data(), kernel.data(), taps, out, w);
+
+			// The texels of a row are a band of one column
+			const uint32_t edge = std::min(w, radius);
+			band.assign(padded.begin() + radius, padded.begin() + radius + band_columns);
+			clamped_passes(band, band_columns, 1, gaussian_kernel, num_pass);
+			std::copy_n(band.begin(), edge, out);
+
+			band.assign(padded.begin() + radius + w - band_columns, padded.begin() + radius + w);
+			clamped_passes(band, band_columns, 1, gaussian_kernel, num_pass);
+			std::copy(band.end() - edge, band.end(), out + w - edge);
 		}
+	});
+
+	// Second pass: blur vertically, a tile of rows and columns at a time so the rows under the kernel stay in cache
+	const uint32_t tiles_x = (w + BLUR_TILE_WIDTH - 1) / BLUR_TILE_WIDTH;
+	const uint32_t tiles_y = (h + BLUR_TILE_HEIGHT - 1) / BLUR_TILE_HEIGHT;
+	task_scheduler::instance().parallel_for(tiles_x * tiles_y, [&](uint32_t tile)
+	{
+		const uint32_t first_column = (tile % tiles_x) * BLUR_TILE_WIDTH;
+		const uint32_t columns = std::min(BLUR_TILE_WIDTH, w - first_column);
+		const uint32_t first_row = (tile / tiles_x) * BLUR_TILE_HEIGHT;
+		const uint32_t last_row = std::min(first_row + BLUR_TILE_HEIGHT, h);
 
-		// Second pass: blur vertically
-		for (uint32_t j = 0; j < w; ++j)
+		// The tiles touching the top or the bottom border blur the columns of their band pass by pass
+		auto blur_band = [&](uint32_t first_band_row)
 		{
-			for (uint32_t i = 0; i < h; ++i)
+			std::vector<float> band(static_cast<size_t>(band_rows) * columns);
+			for (uint32_t i = 0; i < band_rows; ++i)
 			{
-				float sum = .0f;
-				for (int32_t k = -kernel_half_width; k <= kernel_half_width; ++k)
+				const float* row = temp.raw() + static_cast<size_t>(first_band_row + i) * w + first_column;
+				std::copy_n(row, columns, band.begin() + static_cast<size_t>(i) * columns);
+			}
+
+			clamped_passes(band, band_rows, columns, gaussian_kernel, num_pass);
+			return band;
+		};
+
+		const std::vector<float> top_band = first_row < radius ? blur_band(0) : std::vector<float>();
+		const std::vector<float> bottom_band = last_row + radius > h ? blur_band(h - band_rows) : std::vector<float>();
+
+		std::vector<const float*> sources(taps);
+		std::vector<float> quantized_row(output ? columns : 0);
+		for (uint32_t i = first_row; i < last_row; ++i)
+		{
+			const size_t offset = static_cast<size_t>(i) * w + first_column;
+			float* row = output ? quantized_row.data() : image.raw() + offset;
+
+			if (i < radius)
+				std::copy_n(top_band.begin() + static_cast<size_t>(i) * columns, columns, row);
+			else if (i + radius >= h)
+				std::copy_n(bottom_band.begin() + static_cast<size_t>(i - (h - band_rows)) * columns, columns, row);
+			else
+			{
+				for (uint32_t t = 0; t < taps; ++t)
 				{
-					const uint32_t sample_i = clamp(i + k, (uint32_t)0, h - 1);
-					const uint32_t index = sample_i * w + j;
-					sum += temp[index] * gaussian_kernel[k + kernel_half_width];
+					const int64_t sample_i = clamp(static_cast<int64_t>(i) + t - radius, static_cast<int64_t>(0), static_cast<int64_t>(h) - 1);
+					sources[t] = temp.raw() + sample_i * w + first_column;
 				}
-
-				const uint32_t index = i * w + j;
-				image[index] = sum;
+				weighted_sum(sources.data(), kernel.data(), taps, row, columns);
 			}
+
+			apply_point_ops(after, row, columns);
+			if (output)
+				output->store(row, first_column, i, offset, columns);
 		}
-	}
+	});
+}
 
-	promise.set_value();
+// Island and mean vertex normal of every face of the mesh, as streams for the gathers
+struct face_surfaces
+{
+	std::vector<uint32_t> islands;
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+};
+
+static float power(float base, uint32_t exponent)
+{
+	float result = 1.f;
+	for (; exponent > 0; exponent >>= 1, base *= base)
+		if (exponent & 1)
+			result *= base;
+	return result;
 }
 
-std::future<void> gaussian_blur(image_f32& image, uint32_t num_pass, uint32_t kernel_size, float sigma)
+// Same as weighted_sum, but every sample is weighted by how similar its face is to the face of the center sample
+// The samples outside the UV unwrap are ignored and the output of the empty texels is the center value
+static void bilateral_sum(const float* const* sources, const uint32_t* const* faces, const float* kernel, uint32_t taps, uint32_t center,
+						  const face_surfaces& surfaces, uint32_t normal_exponent, float* out, uint32_t count)
 {
-	return async_apply(gaussian_blur_helper, std::ref(image), num_pass, kernel_size, sigma);
+	uint32_t i = 0;
+
+#if defined(__AVX2__)
+	const int* islands = reinterpret_cast<const int*>(surfaces.islands.data());
+	const __m256i no_face = _mm256_set1_epi32(-1);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i center_face = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(faces[center] + i));
+		const __m256i covered = _mm256_xor_si256(_mm256_cmpeq_epi32(center_face, no_face), no_face);
+		const __m256 center_value = _mm256_loadu_ps(sources[center] + i);
+		if (_mm256_testz_si256(covered, covered))
+		{
+			_mm256_storeu_ps(out + i, center_value);
+			continue;
+		}
+
+		const __m256i center_island = _mm256_mask_i32gather_epi32(no_face, islands, center_face, covered, 4);
+		const __m256 center_x = _mm256_mask_i32gather_ps(zero, surfaces.x.data(), center_face, _mm256_castsi256_ps(covered), 4);
+		const __m256 center_y = _mm256_mask_i32gather_ps(zero, surfaces.y.data(), center_face, _mm256_castsi256_ps(covered), 4);
+		const __m256 center_z = _mm256_mask_i32gather_ps(zero, surfaces.z.data(), center_face, _mm256_castsi256_ps(covered), 4);
+
+		__m256 sum = _mm256_setzero_ps();
+		__m256 weights = _mm256_setzero_ps();
+		for (uint32_t t = 0; t < taps; ++t)
+		{
+			const __m256i face = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(faces[t] + i));
+			const __m256i same_face = _mm256_cmpeq_epi32(face, center_face);
+
+			__m256 weight;
+			if (_mm256_testc_si256(same_face, covered))
+			{
+				// NOTE(Corralx): Every covered texel samples its own face, the common case at high resolutions
+				weight = one;
+			}
+			else
+			{
+				const __m256i valid = _mm256_andnot_si256(_mm256_cmpeq_epi32(face, no_face), covered);
+				const __m256i island = _mm256_mask_i32gather_epi32(no_face, islands, face, valid, 4);
+				const __m256 same_island = _mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpeq_epi32(island, center_island), valid));
+
+				const __m256 x = _mm256_mask_i32gather_ps(zero, surfaces.x.data(), face, same_island, 4);
+				const __m256 y = _mm256_mask_i32gather_ps(zero, surfaces.y.data(), face, same_island, 4);
+				const __m256 z = _mm256_mask_i32gather_ps(zero, surfaces.z.data(), face, same_island, 4);
+				const __m256 cosine = _mm256_fmadd_ps(x, center_x, _mm256_fmadd_ps(y, center_y, _mm256_mul_ps(z, center_z)));
+
+				__m256 base = _mm256_max_ps(cosine, zero);
+				weight = one;
+				for (uint32_t e = normal_exponent; e > 0; e >>= 1, base = _mm256_mul_ps(base, base))
+					if (e & 1)
+						weight = _mm256_mul_ps(weight, base);
+				weight = _mm256_blendv_ps(_mm256_and_ps(weight, same_island), one, _mm256_castsi256_ps(same_face));
+			}
+
+			weight = _mm256_mul_ps(weight, _mm256_set1_ps(kernel[t]));
+			sum = _mm256_fmadd_ps(weight, _mm256_loadu_ps(sources[t] + i), sum);
+			weights = _mm256_add_ps(weights, weight);
+		}
+
+		// The samples of the center face always weight their kernel value, the covered texels never divide by zero
+		const __m256 filtered = _mm256_div_ps(sum, _mm256_blendv_ps(one, weights, _mm256_castsi256_ps(covered)));
+		_mm256_storeu_ps(out + i, _mm256_blendv_ps(center_value, filtered, _mm256_castsi256_ps(covered)));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		const uint32_t center_face = faces[center][i];
+		if (center_face == NO_FACE)
+		{
+			out[i] = sources[center][i];
+			continue;
+		}
+
+		const glm::vec3 center_normal(surfaces.x[center_face], surfaces.y[center_face], surfaces.z[center_face]);
+		float sum = .0f;
+		float weights = .0f;
+		for (uint32_t t = 0; t < taps; ++t)
+		{
+			const uint32_t face = faces[t][i];
+			if (face == NO_FACE || surfaces.islands[face] != surfaces.islands[center_face])
+				continue;
+
+			const glm::vec3 normal(surfaces.x[face], surfaces.y[face], surfaces.z[face]);
+			const float similarity = face != center_face ? power(std::max(glm::dot(normal, center_normal), .0f), normal_exponent) : 1.f;
+			const float weight = kernel[t] * similarity;
+			sum += weight * sources[t][i];
+			weights += weight;
+		}
+
+		out[i] = sum / weights;
+	}
 }
 
-static void dither_helper(image_f32& image, std::promise<void> promise)
+static void bilateral_texels(image_f32& image, const mesh_t& mesh, const image_u32& indices_map, uint32_t num_pass,
+							 uint32_t kernel_size, float sigma, uint32_t normal_exponent)
 {
+	assert(kernel_size > 0);
+	assert(image.width() == indices_map.width() && image.height() == indices_map.height());
 	const uint32_t h = image.height();
 	const uint32_t w = image.width();
 
-	// TODO(Corralx): Figure out how to do it (see below)
+	const auto vertices = mesh.vertices();
+	const auto normals = mesh.normals();
+	const auto faces = mesh.faces();
 
-	/* Dithering example
-	const uint32_t dither_matrix[8][8] =
+	face_surfaces surfaces;
+	find_uv_islands(mesh, surfaces.islands);
+	surfaces.x.resize(faces.size());
+	surfaces.y.resize(faces.size());
+	surfaces.z.resize(faces.size());
+	parallel_ranges(static_cast<uint32_t>(faces.size()), [&](uint32_t first_face, uint32_t last_face)
 	{
-		{ 0, 32, 8, 40, 2, 34, 10, 42 },
-		{ 48, 16, 56, 24, 50, 18, 58, 26 },
-		{ 12, 44, 4, 36, 14, 46, 6, 38 },	
-		{ 60, 28, 52, 20, 62, 30, 54, 22 },
-		{ 3, 35, 11, 43, 1, 33, 9, 41 },
-		{ 51, 19, 59, 27, 49, 17, 57, 25 },	
-		{ 15, 47, 7, 39, 13, 45, 5, 37 },
-		{ 63, 31, 55, 23, 61, 29, 53, 21 }
-	};
+		for (uint32_t f = first_face; f < last_face; ++f)
+		{
+			const face_t& face = faces[f];
+			glm::vec3 n = normals[face.v0] + normals[face.v1] + normals[face.v2];
+			if (glm::dot(n, n) == 0.f)
+				n = glm::cross(vertices[face.v1] - vertices[face.v0], vertices[face.v2] - vertices[face.v0]);
+			if (glm::dot(n, n) > 0.f)
+				n = glm::normalize(n);
 
-	for (uint32_t i = 0; i < occlusion_map_height; ++i)
+			surfaces.x[f] = n.x;
+			surfaces.y[f] = n.y;
+			surfaces.z[f] = n.z;
+		}
+	});
+
+	const std::vector<float> kernel = generate_gaussian_kernel_1d(sigma, kernel_size);
+	const uint32_t taps = kernel_size;
+	const uint32_t radius = kernel_size / 2;
+
+	image_f32 temp(w, h);
+
+	for (uint32_t pass = 0; pass < num_pass; ++pass)
 	{
-		for (uint32_t j = 0; j < occlusion_map_width; ++j)
+		// First pass: blur horizontally, padding the values and the faces of every row with its edge
+		parallel_ranges(h, [&](uint32_t first_row, uint32_t last_row)
 		{
-			uint32_t index = i * occlusion_map_width + j;
+			std::vector<float> padded(w + taps - 1);
+			std::vector<uint32_t> padded_faces(w + taps - 1);
+			std::vector<const float*> sources(taps);
+			std::vector<const uint32_t*> sample_faces(taps);
+			for (uint32_t t = 0; t < taps; ++t)
+			{
+				sources[t] = padded.data() + t;
+				sample_faces[t] = padded_faces.data() + t;
+			}
 
-			uint32_t x = j % 8;
-			uint32_t y = i % 8;
+			for (uint32_t i = first_row; i < last_row; ++i)
+			{
+				const float* row = image.raw() + static_cast<size_t>(i) * w;
+				std::fill_n(padded.begin(), radius, row[0]);
+				std::copy(row, row + w, padded.begin() + radius);
+				std::fill(padded.begin() + radius + w, padded.end(), row[w - 1]);
 
-			float limit = static_cast<float>(dither_matrix[x][y] + 1) / 64.f;
+				const uint32_t* face_row = indices_map.raw() + static_cast<size_t>(i) * w;
+				std::fill_n(padded_faces.begin(), radius, face_row[0]);
+				std::copy(face_row, face_row + w, padded_faces.begin() + radius);
+				std::fill(padded_faces.begin() + radius + w, padded_faces.end(), face_row[w - 1]);
 
-			float value = occlusion_map[index];
-			if (value < limit)
-				occlusion_map[index] = saturate(value + (limit / 16.f));
-			else
-				occlusion_map[index] = saturate(value - (limit / 16.f));
+				bilateral_sum(sources.data(), sample_faces.data(), kernel.data(), taps, radius, surfaces, normal_exponent,
+							  temp.raw() + static_cast<size_t>(i) * w, w);
+			}
+		});
+
+		// Second pass: blur vertically, in tiles like the gaussian blur
+		const uint32_t tiles_x = (w + BLUR_TILE_WIDTH - 1) / BLUR_TILE_WIDTH;
+		const uint32_t tiles_y = (h + BLUR_TILE_HEIGHT - 1) / BLUR_TILE_HEIGHT;
+		task_scheduler::instance().parallel_for(tiles_x * tiles_y, [&](uint32_t tile)
+		{
+			const uint32_t first_column = (tile % tiles_x) * BLUR_TILE_WIDTH;
+			const uint32_t columns = std::min(BLUR_TILE_WIDTH, w - first_column);
+			const uint32_t first_row = (tile / tiles_x) * BLUR_TILE_HEIGHT;
+			const uint32_t last_row = std::min(first_row + BLUR_TILE_HEIGHT, h);
+
+			std::vector<const float*> sources(taps);
+			std::vector<const uint32_t*> sample_faces(taps);
+			for (uint32_t i = first_row; i < last_row; ++i)
+			{
+				for (uint32_t t = 0; t < taps; ++t)
+				{
+					const int64_t sample_i = clamp(static_cast<int64_t>(i) + t - radius, static_cast<int64_t>(0), static_cast<int64_t>(h) - 1);
+					sources[t] = temp.raw() + sample_i * w + first_column;
+					sample_faces[t] = indices_map.raw() + sample_i * w + first_column;
+				}
+
+				bilateral_sum(sources.data(), sample_faces.data(), kernel.data(), taps, radius, surfaces, normal_exponent,
+							  image.raw() + static_cast<size_t>(i) * w + first_column, columns);
+			}
+		});
+	}
+
+}
+
+
+static quantized_output make_output(image_u8* output, dither_mode mode)
+{
+	return { mode, output->raw(), nullptr };
+}
+
+static quantized_output make_output(image_u16* output, dither_mode mode)
+{
+	return { mode, nullptr, output->raw() };
+}
+
+static void run_stages(const std::vector<postprocess_stage>& stages, image_f32& image, const quantized_output* output)
+{
+
+	/* NOTE(Corralx): The point stages are accumulated and applied by the next sweep over the texels, either the
+	   load of a gaussian blur, or a sweep of their own before the stages which cannot take them
+	   The point stages right after a gaussian blur are applied by its store, which converts to the output if it is the last stage */
+	std::vector<postprocess_op> pending;
+	bool converted = false;
+	for (size_t s = 0; s < stages.size(); ++s)
+	{
+		const postprocess_stage& stage = stages[s];
+		if (is_point_op(stage.op))
+		{
+			pending.push_back(stage.op);
+			continue;
+		}
+
+		if (stage.op == postprocess_op::GAUSSIAN_BLUR)
+		{
+			std::vector<postprocess_op> after;
+			while (s + 1 < stages.size() && is_point_op(stages[s + 1].op))
+				after.push_back(stages[++s].op);
+
+			converted = s + 1 == stages.size();
+			gaussian_texels(image, stage.num_pass, stage.kernel_size, stage.sigma, pending, after, converted ? output : nullptr);
+			pending.clear();
+			continue;
 		}
+
+		point_texels(image, pending, nullptr);
+		pending.clear();
+
+		if (stage.op == postprocess_op::DILATE)
+			dilate_texels(image, *stage.indices_map, stage.padding);
+		else
+			bilateral_texels(image, *stage.mesh, *stage.indices_map, stage.num_pass, stage.kernel_size, stage.sigma, stage.normal_exponent);
+	}
+
+	if (!converted)
+		point_texels(image, pending, output);
+}
+
+template<typename Output>
+static void run_pipeline_helper(const std::vector<postprocess_stage>& stages, image_f32& image, Output* output,
+								dither_mode mode, std::promise<void> promise)
+{
+	if (!output)
+	{
+		run_stages(stages, image, nullptr);
+		promise.set_value();
+		return;
+	}
+
+	assert(output->width() == image.width() && output->height() == image.height());
+
+	// NOTE(Corralx): The error diffusion is not a point stage, the texels are quantized by a sweep of its own
+	if (mode == dither_mode::ERROR_DIFFUSION)
+	{
+		run_stages(stages, image, nullptr);
+		diffuse_errors(image, output->raw());
+	}
+	else
+	{
+		const quantized_output quantized = make_output(output, mode);
+		run_stages(stages, image, &quantized);
 	}
-	*/
 
 	promise.set_value();
 }
 
-std::future<void> dither(image_f32& image)
+postprocess_pipeline& postprocess_pipeline::dilate(const image_u32& indices_map, uint32_t padding)
+{
+	postprocess_stage stage{};
+	stage.op = postprocess_op::DILATE;
+	stage.indices_map = &indices_map;
+	stage.padding = padding;
+	_stages.push_back(stage);
+	return *this;
+}
+
+postprocess_pipeline& postprocess_pipeline::bilateral_blur(const mesh_t& mesh, const image_u32& indices_map, uint32_t num_pass,
+														   uint32_t kernel_size, float sigma, uint32_t normal_exponent)
+{
+	postprocess_stage stage{};
+	stage.op = postprocess_op::BILATERAL_BLUR;
+	stage.mesh = &mesh;
+	stage.indices_map = &indices_map;
+	stage.num_pass = num_pass;
+	stage.kernel_size = kernel_size;
+	stage.sigma = sigma;
+	stage.normal_exponent = normal_exponent;
+	_stages.push_back(stage);
+	return *this;
+}
+
+postprocess_pipeline& postprocess_pipeline::gaussian_blur(uint32_t num_pass, uint32_t kernel_size, float sigma)
+{
+	postprocess_stage stage{};
+	stage.op = postprocess_op::GAUSSIAN_BLUR;
+	stage.num_pass = num_pass;
+	stage.kernel_size = kernel_size;
+	stage.sigma = sigma;
+	_stages.push_back(stage);
+	return *this;
+}
+
+postprocess_pipeline& postprocess_pipeline::invert()
+{
+	postprocess_stage stage{};
+	stage.op = postprocess_op::INVERT;
+	_stages.push_back(stage);
+	return *this;
+}
+
+std::future<void> postprocess_pipeline::run(image_f32& image) const
+{
+	return async_apply(run_pipeline_helper<image_u8>, _stages, std::ref(image), static_cast<image_u8*>(nullptr), dither_mode::NONE);
+}
+
+std::future<void> postprocess_pipeline::run(image_f32& image, image_u8& output, dither_mode mode) const
+{
+	return async_apply(run_pipeline_helper<image_u8>, _stages, std::ref(image), &output, mode);
+}
+
+std::future<void> postprocess_pipeline::run(image_f32& image, image_u16& output, dither_mode mode) const
+{
+	return async_apply(run_pipeline_helper<image_u16>, _stages, std::ref(image), &output, mode);
+}
+
+std::future<void> invert(image_f32& image)
+{
+	return postprocess_pipeline().invert().run(image);
+}
+
+std::future<void> dilate(image_f32& image, const image_u32& indices_map, uint32_t padding)
+{
+	return postprocess_pipeline().dilate(indices_map, padding).run(image);
+}
+
+std::future<void> gaussian_blur(image_f32& image, uint32_t num_pass, uint32_t kernel_size, float sigma)
+{
+	return postprocess_pipeline().gaussian_blur(num_pass, kernel_size, sigma).run(image);
+}
+
+std::future<void> bilateral_blur(image_f32& image, const mesh_t& mesh, const image_u32& indices_map, uint32_t num_pass,
+								 uint32_t kernel_size, float sigma, uint32_t normal_exponent)
+{
+	return postprocess_pipeline().bilateral_blur(mesh, indices_map, num_pass, kernel_size, sigma, normal_exponent).run(image);
+}
+
+template<typename Output>
+static void quantize_helper(const image_f32& image, Output& output, dither_mode mode, std::promise<void> promise)
+{
+	assert(output.width() == image.width() && output.height() == image.height());
+	const uint32_t h = image.height();
+	const uint32_t w = image.width();
+
+	if (mode == dither_mode::ERROR_DIFFUSION)
+		diffuse_errors(image, output.raw());
+	else
+	{
+		parallel_ranges(h, [&](uint32_t first_row, uint32_t last_row)
+		{
+			for (uint32_t i = first_row; i < last_row; ++i)
+			{
+				const size_t offset = static_cast<size_t>(i) * w;
+				quantize_row(image.raw() + offset, output.raw() + offset, w, threshold_row(mode, i), 0);
+			}
+		});
+	}
+
+	promise.set_value();
+}
+
+std::future<void> quantize(const image_f32& image, image_u8& output, dither_mode mode)
+{
+	return async_apply(quantize_helper<image_u8>, std::cref(image), std::ref(output), mode);
+}
+
+std::future<void> quantize(const image_f32& image, image_u16& output, dither_mode mode)
 {
-	return async_apply(dither_helper, std::ref(image));
+	return async_apply(quantize_helper<image_u16>, std::cref(image), std::ref(output), mode);
 }
@@ -2,13 +2,99 @@
 
 #include <cstdint>
 #include <future>
+#include <limits>
+#include <vector>
 
 #include "image.hpp"
 #include "utils.hpp"
 
+class mesh_t;
+
 std::future<void> invert(image<pixel_format::F32>& image);
 
+// Padding of dilate(...) filling every texel of the map
+static const uint32_t DILATE_WHOLE_MAP = std::numeric_limits<uint32_t>::max();
+
+// Copies into the texels outside the UV unwrap the value of the nearest covered texel, up to padding texels away
+// The coverage is read from the indices map the image was baked with
+/* NOTE(Corralx): The nearest texels are found with a separable distance transform, so the cost does not grow
+   with the padding, run it before filtering so the seams do not blend with the empty texels */
+std::future<void> dilate(image<pixel_format::F32>& occlusion_map, const image<pixel_format::U32>& indices_map, uint32_t padding = DILATE_WHOLE_MAP);
+
 std::future<void> gaussian_blur(image<pixel_format::F32>& image, uint32_t num_pass, uint32_t kernel_size, float sigma = 1.f);
 
-// TODO(Corralx): Figure out good parametrization for this
-std::future<void> dither(image<pixel_format::F32>& image);
+// Gaussian blur weighting every sample by the similarity of its surface, the empty texels are left untouched
+// Samples outside the UV unwrap or from another UV island are ignored, the others are weighted by the cosine
+// between the face normals raised to normal_exponent, so the blur stops at the seams and at the creases
+/* NOTE(Corralx): The normals alone cannot tell if two texels are close on the surface, texels of different islands
+   next to each other in UV space usually are not, so the island is always required to match
+   The filter is not separable, the two 1D passes are an approximation good enough for denoising
+   Unlike the gaussian blur its passes cannot be fused and every tap gathers face data, so it costs several times as much,
+   about 4.5x for 3 passes of 5 taps at 4096^2, and it is only used when asked for */
+std::future<void> bilateral_blur(image<pixel_format::F32>& occlusion_map, const mesh_t& mesh, const image<pixel_format::U32>& indices_map,
+								 uint32_t num_pass, uint32_t kernel_size, float sigma = 1.f, uint32_t normal_exponent = 8);
+
+enum class dither_mode : uint8_t
+{
+	// Rounds to the nearest level, smooth gradients band
+	NONE = 0,
+	// Ordered dither with an 8x8 Bayer matrix, cheap but with a visible cross hatch pattern
+	BAYER = 1,
+	// Ordered dither with a 64x64 blue noise threshold map, the noise is high frequency and hard to see
+	BLUE_NOISE = 2,
+	// Serpentine Floyd-Steinberg, the error of every texel is spread on its neighbours
+	ERROR_DIFFUSION = 3
+};
+
+// Quantizes the [0, 1] range of the image to the full range of the output, dithering the rounding so the gradients do not band
+/* NOTE(Corralx): The ordered dithers are parallel over the texels, the error diffusion runs in parallel over bands
+   of rows, starting every band a few rows above it so the error does not restart at its border */
+std::future<void> quantize(const image<pixel_format::F32>& occlusion_map, image<pixel_format::U8>& output, dither_mode mode = dither_mode::BLUE_NOISE);
+std::future<void> quantize(const image<pixel_format::F32>& occlusion_map, image<pixel_format::U16>& output, dither_mode mode = dither_mode::BLUE_NOISE);
+
+enum class postprocess_op : uint8_t
+{
+	DILATE = 0,
+	BILATERAL_BLUR = 1,
+	GAUSSIAN_BLUR = 2,
+	INVERT = 3
+};
+
+// A stage of a postprocess_pipeline, only the parameters of its operation are meaningful
+struct postprocess_stage
+{
+	postprocess_op op;
+	const mesh_t* mesh;
+	const image<pixel_format::U32>* indices_map;
+	uint32_t padding;
+	uint32_t num_pass;
+	uint32_t kernel_size;
+	float sigma;
+	uint32_t normal_exponent;
+};
+
+// Chain of the postprocessing stages above, run in the order they are added with as few sweeps over the texels as possible
+/* NOTE(Corralx): The point stages (invert) and the ordered dithers are applied while the next gaussian blur loads its rows,
+   while the previous one stores them or while quantizing to the output, they only get a sweep of their own when no such pass
+   is next to them, so invert, blur, invert and the conversion to 8 bits take two sweeps, the two passes of the blur
+   The mesh and the indices maps of the stages must outlive the run */
+class postprocess_pipeline
+{
+public:
+	postprocess_pipeline& dilate(const image<pixel_format::U32>& indices_map, uint32_t padding = DILATE_WHOLE_MAP);
+	postprocess_pipeline& bilateral_blur(const mesh_t& mesh, const image<pixel_format::U32>& indices_map, uint32_t num_pass,
+										 uint32_t kernel_size, float sigma = 1.f, uint32_t normal_exponent = 8);
+	postprocess_pipeline& gaussian_blur(uint32_t num_pass, uint32_t kernel_size, float sigma = 1.f);
+	postprocess_pipeline& invert();
+
+	// When the future is ready, the occlusion map holds the result
+	std::future<void> run(image<pixel_format::F32>& occlusion_map) const;
+
+	// When the future is ready, the output holds the result quantized like quantize(...) does
+	// The occlusion map is used as the working buffer, its content is unspecified afterwards
+	std::future<void> run(image<pixel_format::F32>& occlusion_map, image<pixel_format::U8>& output, dither_mode mode = dither_mode::BLUE_NOISE) const;
+	std::future<void> run(image<pixel_format::F32>& occlusion_map, image<pixel_format::U16>& output, dither_mode mode = dither_mode::BLUE_NOISE) const;
+
+private:
+	std::vector<postprocess_stage> _stages;
+};
@@ -1,351 +1,358 @@
 #include "rasterizer.hpp"
 #include "mesh.hpp"
 #include "utils.hpp"
+#include "task_scheduler.hpp"
 
-#include "GL/gl3w.h"
-#include "SDL2/SDL.h"
 #include "glm/glm.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
 using image_u32 = image<pixel_format::U32>;
 
-extern SDL_Window* window;
+static constexpr uint32_t INVALID_SAMPLE = std::numeric_limits<uint32_t>::max();
 
-// NOTE(Corralx): We are on a separate thread so we use a different gl context
-static void rasterize_hardware_helper(const mesh_t& mesh, image_u32& image, std::promise<void> promise)
-{
-	static auto context = SDL_GL_CreateContext(window);
-	SDL_GL_MakeCurrent(window, context);
-
-	// Texture
-	uint32_t texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, image.width(), image.height(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, image.raw());
-
-	// Framebuffer
-	uint32_t framebuffer;
-	glGenFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
-
-	assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-
-	// VAO
-	uint32_t vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// Vertices
-	const auto& vertex_data = mesh.texture_coords();
-	uint32_t vertex_buffer;
-	glGenBuffers(1, &vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(float) * vertex_data.size(), vertex_data.data(), GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-	// Indices
-	const auto& index_data = mesh.faces();
-	uint32_t index_buffer;
-	glGenBuffers(1, &index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(uint32_t) * index_data.size(), index_data.data(), GL_STATIC_DRAW);
-
-	// Program
-	const char* vs_source =
-		"#version 330 core\n \
-		\n \
-		layout(location = 0) in vec2 position;\n \
-		\n \
-		void main()\n \
-		{\n \
-			gl_Position = vec4(position * 2.0 - 1.0, 0.5, 1.0);\n \
-		}\n \
-		";
-
-	const char* fs_source =
-		"#version 330 core\n \
-		\n \
-		layout(location = 0) out uint out_color;\n \
-		\n \
-		void main()\n \
-		{\n \
-			out_color = uint(gl_PrimitiveID);\n \
-		}\n \
-		";
-
-	uint32_t vs = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vs, 1, &vs_source, nullptr);
-	glCompileShader(vs);
-
-	uint32_t fs = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fs, 1, &fs_source, nullptr);
-	glCompileShader(fs);
-
-	uint32_t program = glCreateProgram();
-	glAttachShader(program, vs);
-	glAttachShader(program, fs);
-	glLinkProgram(program);
-
-	assert(glGetError() == GL_NO_ERROR);
-
-	glUseProgram(program);
-	glViewport(0, 0, image.width(), image.height());
-
-	// Draw
-	glDrawElements(GL_TRIANGLES, (uint32_t)index_data.size() * 3, GL_UNSIGNED_INT, nullptr);
-
-	// Copy back the data
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, image.raw());
-
-	// Delete program
-	glDeleteShader(vs);
-	glDeleteShader(fs);
-	glDeleteProgram(program);
-
-	// Delete buffers
-	glDeleteBuffers(1, &index_buffer);
-	glDeleteBuffers(1, &vertex_buffer);
-	glDeleteVertexArrays(1, &vao);
-
-	// Delete framebuffer
-	glDeleteTextures(1, &texture);
-	glDeleteFramebuffers(1, &framebuffer);
-	assert(glGetError() == GL_NO_ERROR);
+// Size of a bin in final image pixels, the supersampled tile is TILE_SIZE * supersampling wide
+static constexpr uint32_t TILE_SIZE = 32;
 
-	promise.set_value();
-}
+// Half-space setup of a triangle in supersampled pixel coordinates
+// Each edge function is E(x, y) = a * x + b * y + c and is positive inside the triangle
+struct triangle_setup
+{
+	float a[3];
+	float b[3];
+	double c[3];
+
+	// Edges owning the pixels exactly on them, following the top-left rule
+	bool owns_edge[3];
+
+	// Bounding box in supersampled pixels, max is exclusive
+	int32_t min_x;
+	int32_t min_y;
+	int32_t max_x;
+	int32_t max_y;
+};
 
-std::future<void> rasterize_triangle_hardware(const mesh_t& mesh, image_u32& image)
+struct raster_target
 {
-	return async_apply(rasterize_hardware_helper, std::ref(mesh), std::ref(image));
-}
+	uint32_t width;
+	uint32_t height;
+	uint32_t tiles_x;
+	uint32_t tiles_y;
+	uint32_t supersampling;
+};
 
-// TODO(Corralx): Reimplement software version (see code below)
-static void rasterize_software_helper(const mesh_t& mesh, image_u32& image, uint8_t supersampling, std::promise<void> promise)
+// NOTE(Corralx): Returns false for degenerate triangles or triangles outside of the target
+static bool setup_triangle(const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2,
+						   const raster_target& target, triangle_setup& setup)
 {
-	mesh;
-	image;
-	supersampling;
+	const double width = target.width;
+	const double height = target.height;
 
-	promise.set_value();
+	const double x[3] = { uv0.x * width, uv1.x * width, uv2.x * width };
+	const double y[3] = { uv0.y * height, uv1.y * height, uv2.y * height };
+
+	double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (std::abs(area) < 1e-12)
+		return false;
+
+	// Flip the edges of clockwise triangles so the inside is always positive
+	const double sign = area > 0 ? 1. : -1.;
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		const uint32_t next = (i + 1) % 3;
+		const double a = sign * (y[i] - y[next]);
+		const double b = sign * (x[next] - x[i]);
+
+		setup.a[i] = static_cast<float>(a);
+		setup.b[i] = static_cast<float>(b);
+		setup.c[i] = sign * (x[i] * y[next] - x[next] * y[i]);
+		setup.owns_edge[i] = a > 0 || (a == 0 && b > 0);
+	}
+
+	// Pixel centers are at half coordinates, the box is clamped to the target
+	const double min_x = std::min({ x[0], x[1], x[2] });
+	const double min_y = std::min({ y[0], y[1], y[2] });
+	const double max_x = std::max({ x[0], x[1], x[2] });
+	const double max_y = std::max({ y[0], y[1], y[2] });
+
+	setup.min_x = static_cast<int32_t>(clamp(std::ceil(min_x - .5), .0, width));
+	setup.min_y = static_cast<int32_t>(clamp(std::ceil(min_y - .5), .0, height));
+	setup.max_x = static_cast<int32_t>(clamp(std::floor(max_x - .5) + 1., .0, width));
+	setup.max_y = static_cast<int32_t>(clamp(std::floor(max_y - .5) + 1., .0, height));
+
+	return setup.min_x < setup.max_x && setup.min_y < setup.max_y;
 }
 
-std::future<void> rasterize_triangle_software(const mesh_t & mesh, image_u32& image, uint8_t supersampling)
+// Bins are stored as a single array of triangle indices, sorted by tile and then by triangle index
+struct triangle_bins
 {
-	return async_apply(rasterize_software_helper, std::ref(mesh), std::ref(image), supersampling);
-}
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> triangles;
+};
 
-/*
-struct edge_t
+static void bin_triangles(const std::vector<triangle_setup>& setups, const std::vector<uint8_t>& valid,
+						  const raster_target& target, uint32_t worker_num, triangle_bins& bins)
 {
-	edge_t() = delete;
-	edge_t(const glm::vec2& _v0, const glm::vec2& _v1) : v0(_v0), v1(_v1)
+	const uint32_t num_tiles = target.tiles_x * target.tiles_y;
+	const uint32_t num_tris = static_cast<uint32_t>(setups.size());
+	const uint32_t tile_pixels = TILE_SIZE * target.supersampling;
+	const uint32_t chunk = (num_tris + worker_num - 1) / worker_num;
+
+	// Tile coverage of a triangle is its bounding box in tile units
+	auto for_each_tile = [&](uint32_t tris_index, auto f)
+	{
+		const triangle_setup& s = setups[tris_index];
+		const uint32_t tile_min_x = s.min_x / tile_pixels;
+		const uint32_t tile_min_y = s.min_y / tile_pixels;
+		const uint32_t tile_max_x = (s.max_x - 1) / tile_pixels;
+		const uint32_t tile_max_y = (s.max_y - 1) / tile_pixels;
+
+		for (uint32_t ty = tile_min_y; ty <= tile_max_y; ++ty)
+			for (uint32_t tx = tile_min_x; tx <= tile_max_x; ++tx)
+				f(ty * target.tiles_x + tx);
+	};
+
+	// First pass: every worker counts the triangles of its own range falling in each tile
+	std::vector<uint32_t> counts(static_cast<size_t>(num_tiles) * worker_num, 0);
+	task_scheduler::instance().parallel_for(worker_num, [&](uint32_t worker)
+	{
+		uint32_t* worker_counts = counts.data() + static_cast<size_t>(worker) * num_tiles;
+		const uint32_t end = std::min(num_tris, (worker + 1) * chunk);
+		for (uint32_t t = worker * chunk; t < end; ++t)
+			if (valid[t])
+				for_each_tile(t, [&](uint32_t tile) { ++worker_counts[tile]; });
+	});
+
+	// Exclusive prefix sum in (tile, worker) order, so each bin keeps the triangles sorted
+	bins.offsets.resize(num_tiles + 1);
+	uint32_t running = 0;
+	for (uint32_t tile = 0; tile < num_tiles; ++tile)
 	{
-		// Ordering vertices so that v0 is always the lower end
-		if (_v0.y > _v1.y)
+		bins.offsets[tile] = running;
+		for (uint32_t worker = 0; worker < worker_num; ++worker)
 		{
-			v0 = _v1;
-			v1 = _v0;
+			uint32_t& count = counts[static_cast<size_t>(worker) * num_tiles + tile];
+			const uint32_t c = count;
+			count = running;
+			running += c;
 		}
 	}
+	bins.offsets[num_tiles] = running;
+	bins.triangles.resize(running);
 
-	glm::vec2 v0;
-	glm::vec2 v1;
-};
+	// Second pass: scatter the triangle indices at the positions reserved above
+	task_scheduler::instance().parallel_for(worker_num, [&](uint32_t worker)
+	{
+		uint32_t* worker_offsets = counts.data() + static_cast<size_t>(worker) * num_tiles;
+		const uint32_t end = std::min(num_tris, (worker + 1) * chunk);
+		for (uint32_t t = worker * chunk; t < end; ++t)
+			if (valid[t])
+				for_each_tile(t, [&](uint32_t tile) { bins.triangles[worker_offsets[tile]++] = t; });
+	});
+}
 
-struct span_t
+// Writes the triangle index in every covered sample of the row span [x_start, x_end) of the tile buffer
+static void rasterize_span(const triangle_setup& s, uint32_t tris_index, int32_t y, int32_t x_start, int32_t x_end,
+						   int32_t tile_x, uint32_t* row)
 {
-	span_t() = delete;
-	span_t(uint32_t _x0, uint32_t _x1) : x0(_x0), x1(_x1)
+	const double py = y + .5;
+	const double px = x_start + .5;
+
+	float e[3];
+	for (uint32_t i = 0; i < 3; ++i)
+		e[i] = static_cast<float>(s.a[i] * px + s.b[i] * py + s.c[i]);
+
+#if defined(__AVX2__)
+	const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 lane = _mm256_cvtepi32_ps(lane_index);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i index = _mm256_set1_epi32(static_cast<int32_t>(tris_index));
+
+	__m256 edge[3];
+	__m256 step[3];
+	__m256 owns[3];
+	for (uint32_t i = 0; i < 3; ++i)
 	{
-		// Ordering vertices so that x0 is always the left end
-		if (_x0 > _x1)
+		const __m256 a = _mm256_set1_ps(s.a[i]);
+		edge[i] = _mm256_add_ps(_mm256_set1_ps(e[i]), _mm256_mul_ps(a, lane));
+		step[i] = _mm256_mul_ps(a, _mm256_set1_ps(8.f));
+		owns[i] = _mm256_castsi256_ps(_mm256_set1_epi32(s.owns_edge[i] ? -1 : 0));
+	}
+
+	for (int32_t x = x_start; x < x_end; x += 8)
+	{
+		__m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t i = 0; i < 3; ++i)
 		{
-			x0 = _x1;
-			x1 = _x0;
+			const __m256 inside = _mm256_cmp_ps(edge[i], zero, _CMP_GT_OQ);
+			const __m256 on_edge = _mm256_and_ps(_mm256_cmp_ps(edge[i], zero, _CMP_EQ_OQ), owns[i]);
+			mask = _mm256_and_ps(mask, _mm256_or_ps(inside, on_edge));
+			edge[i] = _mm256_add_ps(edge[i], step[i]);
 		}
+
+		// Lanes past the end of the span are outside the bounding box, so outside the triangle
+		const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(x_end - x), lane_index);
+		const __m256i store_mask = _mm256_and_si256(_mm256_castps_si256(mask), valid);
+		_mm256_maskstore_epi32(reinterpret_cast<int*>(row + (x - tile_x)), store_mask, index);
 	}
+#else
+	for (int32_t x = x_start; x < x_end; ++x)
+	{
+		bool covered = true;
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			covered = covered && (e[i] > 0 || (e[i] == 0 && s.owns_edge[i]));
+			e[i] += s.a[i];
+		}
 
-	uint32_t x0;
-	uint32_t x1;
-};
+		if (covered)
+			row[x - tile_x] = tris_index;
+	}
+#endif
+}
 
-uint32_t* indices_map;
+// Picks the most frequent sample, falling back to any valid one when the invalid sample dominates
+static uint32_t majority_sample(const uint32_t* samples, uint32_t num_samples)
 {
-	const uint8_t ssaa_scale = 2;
-	const uint32_t width = occlusion_map_width * ssaa_scale;
-	const uint32_t height = occlusion_map_height * ssaa_scale;
+	uint32_t best_sample = INVALID_SAMPLE;
+	uint32_t sample_count = 0;
+	uint32_t valid_sample = INVALID_SAMPLE;
+
+	for (uint32_t i = 0; i < num_samples; ++i)
+	{
+		const uint32_t count = static_cast<uint32_t>(std::count(samples, samples + num_samples, samples[i]));
+		if (count > sample_count)
+		{
+			sample_count = count;
+			best_sample = samples[i];
+		}
 
-	const tinyobj::mesh_t& mesh = shapes[mesh_index].mesh;
-	const size_t triangle_num = mesh.indices.size() / 3;
+		// Saving a valid sample for later, in case we don't find a sample which dominates
+		if (samples[i] != INVALID_SAMPLE)
+			valid_sample = samples[i];
+	}
 
-	// Allocate supersampled index map and set an invalid value used as sentinel
-	uint32_t* index_map = new uint32_t[width * height];
-	memset(index_map, 255, width * height * sizeof(uint32_t));
+	// If there was a valid sample we use it, if not then all samples are invalid and is safe to use it
+	return best_sample != INVALID_SAMPLE ? best_sample : valid_sample;
+}
 
-	// For each triangle, lookup the pixel it's covering in the occlusion map through triangle scan conversion
-	// http://joshbeam.com/articles/triangle_rasterization/
-	// http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization.html
-	for (uint32_t tris_index = 0; tris_index < triangle_num; ++tris_index)
+static void rasterize_tile(const std::vector<triangle_setup>& setups, const triangle_bins& bins,
+						   const raster_target& target, uint32_t tile, std::vector<uint32_t>& buffer,
+						   std::vector<uint32_t>& samples, image_u32& image)
+{
+	const uint32_t first = bins.offsets[tile];
+	const uint32_t last = bins.offsets[tile + 1];
+	if (first == last)
+		return;
+
+	const uint32_t ss = target.supersampling;
+	const uint32_t tile_pixels = TILE_SIZE * ss;
+	const int32_t tile_x = static_cast<int32_t>((tile % target.tiles_x) * tile_pixels);
+	const int32_t tile_y = static_cast<int32_t>((tile / target.tiles_x) * tile_pixels);
+	const int32_t tile_end_x = std::min(tile_x + static_cast<int32_t>(tile_pixels), static_cast<int32_t>(target.width));
+	const int32_t tile_end_y = std::min(tile_y + static_cast<int32_t>(tile_pixels), static_cast<int32_t>(target.height));
+
+	std::fill(buffer.begin(), buffer.end(), INVALID_SAMPLE);
+
+	// Triangles are sorted, so later triangles overwrite earlier ones like in a sequential rasterizer
+	for (uint32_t b = first; b < last; ++b)
 	{
-		// Vertices index of current triangle
-		const uint32_t v0_index = mesh.indices[tris_index * 3 + 0];
-		const uint32_t v1_index = mesh.indices[tris_index * 3 + 1];
-		const uint32_t v2_index = mesh.indices[tris_index * 3 + 2];
-
-		// UV coordinates of current triangle
-		const glm::vec2 v0_coord{ mesh.texcoords[v0_index * 2 + 0],
-			mesh.texcoords[v0_index * 2 + 1] };
-		const glm::vec2 v1_coord{ mesh.texcoords[v1_index * 2 + 0],
-			mesh.texcoords[v1_index * 2 + 1] };
-		const glm::vec2 v2_coord{ mesh.texcoords[v2_index * 2 + 0] ,
-			mesh.texcoords[v2_index * 2 + 1] };
-
-		// Pixel coordinates pf current triangle
-		const glm::vec2 v0_pixel{ v0_coord.x * width + 0.5,
-			v0_coord.y * height + 0.5 };
-		const glm::vec2 v1_pixel{ v1_coord.x * width + 0.5,
-			v1_coord.y * height + 0.5 };
-		const glm::vec2 v2_pixel{ v2_coord.x * width + 0.5,
-			v2_coord.y * height + 0.5 };
-
-		// Current triangle edges
-		const edge_t edges[3] =
-		{
-			{ v0_pixel, v1_pixel },
-			{ v1_pixel, v2_pixel },
-			{ v2_pixel, v0_pixel }
-		};
+		const uint32_t tris_index = bins.triangles[b];
+		const triangle_setup& s = setups[tris_index];
 
-		// Find the longer edge vertically
-		uint32_t long_edge_index = 0;
-		{
-			float max_length = 0;
-			for (uint32_t edge_index = 0; edge_index < 3; ++edge_index)
-			{
-				float length = edges[edge_index].v1.y - edges[edge_index].v0.y;
-				if (length > max_length)
-				{
-					max_length = length;
-					long_edge_index = edge_index;
-				}
-			}
-		}
+		const int32_t x_start = std::max(s.min_x, tile_x);
+		const int32_t x_end = std::min(s.max_x, tile_end_x);
+		const int32_t y_start = std::max(s.min_y, tile_y);
+		const int32_t y_end = std::min(s.max_y, tile_end_y);
+
+		for (int32_t y = y_start; y < y_end; ++y)
+			rasterize_span(s, tris_index, y, x_start, x_end, tile_x, buffer.data() + (y - tile_y) * tile_pixels);
+	}
 
-		const edge_t long_edge = edges[long_edge_index];
-		const float long_edge_x_extent = long_edge.v1.x - long_edge.v0.x;
-		const float long_edge_y_extent = long_edge.v1.y - long_edge.v0.y;
+	// Downsample the supersampled tile into the final image
+	const uint32_t out_x = tile_x / ss;
+	const uint32_t out_y = tile_y / ss;
+	const uint32_t out_end_x = tile_end_x / ss;
+	const uint32_t out_end_y = tile_end_y / ss;
 
-		// For each short edge, get all the pixel between it and the long edge
-		for (uint32_t short_offset = 0; short_offset < 2; ++short_offset)
+	for (uint32_t i = out_y; i < out_end_y; ++i)
+	{
+		for (uint32_t j = out_x; j < out_end_x; ++j)
 		{
-			const uint32_t short_edge_index = (long_edge_index + 1 + short_offset) % 3;
-			const edge_t short_edge = edges[short_edge_index];
-
-			// Split the long segment to just account for the part as high as the short one
-			const float x0_factor = (short_edge.v0.y - long_edge.v0.y) / long_edge_y_extent;
-			const float x1_factor = (short_edge.v1.y - long_edge.v0.y) / long_edge_y_extent;
-			const float long_segment_x0 = long_edge.v0.x + long_edge_x_extent * x0_factor;
-			const float long_segment_x1 = long_edge.v0.x + long_edge_x_extent * x1_factor;
-			const edge_t long_segment
-			{
-				{ long_segment_x0, short_edge.v0.y },
-				{ long_segment_x1, short_edge.v1.y }
-			};
-
-			// Check if an edge is parallel to the X axis because it doesn't contribute
-			// Both edges are actually checked to account for degenerates triangle
-			const float long_edge_y_diff = long_segment.v1.y - long_segment.v0.y;
-			if (std::abs(long_edge_y_diff) < .0001f)
-				continue;
-
-			const float short_edge_y_diff = short_edge.v1.y - short_edge.v0.y;
-			if (short_edge_y_diff < .0001f)
-				continue;
-
-			const float long_edge_x_diff = long_segment.v1.x - long_segment.v0.x;
-			const float short_edge_x_diff = short_edge.v1.x - short_edge.v0.x;
-
-			float long_interp_factor = (short_edge.v0.y - long_segment.v0.y) / long_edge_y_diff;
-			const float long_interp_step = 1.f / long_edge_y_diff;
-			float short_interp_factor = .0f;
-			const float short_interp_step = 1.f / short_edge_y_diff;
-
-			// For each row the triangle is covering
-			const uint32_t starting_row = static_cast<uint32_t>(long_segment.v0.y + .5f);
-			const uint32_t ending_row = std::min(static_cast<uint32_t>(long_segment.v1.y + .5f), height);
-			for (uint32_t row = starting_row; row < ending_row; ++row)
+			// Collect all samples associated with this pixel
+			for (uint32_t i_sample = 0; i_sample < ss; ++i_sample)
 			{
-				const float x0 = short_edge.v0.x + (short_edge_x_diff * short_interp_factor);
-				const float x1 = long_segment.v0.x + (long_edge_x_diff * long_interp_factor);
-
-				span_t span{ static_cast<uint32_t>(x0 + .5f), std::min(static_cast<uint32_t>(x1 + .5f), width) };
-
-				// If the span is degenerate there is nothing to do
-				uint32_t span_x_diff = span.x1 - span.x0;
-				if (span_x_diff != 0)
-				{
-					// Save the current triangle index in the current pixel position
-					for (uint32_t column = span.x0; column < span.x1; ++column)
-						index_map[row * width + column] = tris_index;
-				}
-
-				short_interp_factor += short_interp_step;
-				long_interp_factor += long_interp_step;
+				const uint32_t* src = buffer.data() + ((i - out_y) * ss + i_sample) * tile_pixels + (j - out_x) * ss;
+				std::copy(src, src + ss, samples.data() + i_sample * ss);
 			}
+
+			const uint32_t best_sample = ss == 1 ? samples[0] : majority_sample(samples.data(), ss * ss);
+			if (best_sample != INVALID_SAMPLE)
+				image[i * image.width() + j] = best_sample;
 		}
 	}
+}
+
+// Half-space rasterization of the UV triangles on a supersampled grid, followed by a majority vote downsample
+// Triangles are binned into screen tiles, which are then rasterized and downsampled in parallel
+static void rasterize_software_helper(const mesh_t& mesh, image_u32& image, uint8_t supersampling, std::promise<void> promise)
+{
+	assert(supersampling > 0);
+
+	const auto faces = mesh.faces();
+	const auto tex_coords = mesh.texture_coords();
+	const uint32_t num_tris = static_cast<uint32_t>(faces.size());
+
+	raster_target target{};
+	target.supersampling = supersampling;
+	target.width = image.width() * supersampling;
+	target.height = image.height() * supersampling;
+	target.tiles_x = (image.width() + TILE_SIZE - 1) / TILE_SIZE;
+	target.tiles_y = (image.height() + TILE_SIZE - 1) / TILE_SIZE;
+
+	const uint32_t worker_num = task_scheduler::instance().worker_count();
+	const uint32_t chunk = (num_tris + worker_num - 1) / worker_num;
 
-	// Now downsample the result into the definitive indices map
-	indices_map = new uint32_t[occlusion_map_width * occlusion_map_height];
-	for (uint32_t i = 0; i < occlusion_map_height; ++i)
+	std::vector<triangle_setup> setups(num_tris);
+	std::vector<uint8_t> valid(num_tris);
+	task_scheduler::instance().parallel_for(worker_num, [&](uint32_t worker)
 	{
-		for (uint32_t j = 0; j < occlusion_map_width; ++j)
+		const uint32_t end = std::min(num_tris, (worker + 1) * chunk);
+		for (uint32_t t = worker * chunk; t < end; ++t)
 		{
-			uint32_t samples[ssaa_scale * ssaa_scale] = {};
-
-			// Collect all samples associated with this pixel
-			for (uint32_t i_sample = 0; i_sample < ssaa_scale; ++i_sample)
-			{
-				for (uint32_t j_sample = 0; j_sample < ssaa_scale; ++j_sample)
-				{
-					const uint32_t dst_index = i_sample * ssaa_scale + j_sample;
-					const uint32_t src_index = (i * ssaa_scale + i_sample) * width + j * ssaa_scale + j_sample;
-					samples[dst_index] = index_map[src_index];
-				}
-			}
+			const face_t& face = faces[t];
+			valid[t] = setup_triangle(tex_coords[face.v0], tex_coords[face.v1], tex_coords[face.v2], target, setups[t]);
+		}
+	});
 
-			uint32_t best_sample = std::numeric_limits<uint32_t>::max();
-			ptrdiff_t sample_count = 0;
-			uint32_t valid_sample = std::numeric_limits<uint32_t>::max();
+	triangle_bins bins;
+	bin_triangles(setups, valid, target, worker_num, bins);
 
-			// Look for the samples with the higher count
-			for (uint32_t sample_idx = 0; sample_idx < ssaa_scale * ssaa_scale; ++sample_idx)
-			{
-				ptrdiff_t count = std::count(std::begin(samples), std::end(samples), samples[sample_idx]);
-				if (count > sample_count)
-				{
-					sample_count = count;
-					best_sample = samples[sample_idx];
-				}
-
-				// Saving a valid sample for later, in case we don't find a sample which dominates
-				if (samples[sample_idx] != std::numeric_limits<uint32_t>::max())
-					valid_sample = samples[sample_idx];
-			}
+	const uint32_t num_tiles = target.tiles_x * target.tiles_y;
+	std::atomic<uint32_t> next_tile(0);
+	task_scheduler::instance().parallel_for(worker_num, [&](uint32_t)
+	{
+		const uint32_t tile_pixels = TILE_SIZE * supersampling;
+		std::vector<uint32_t> buffer(tile_pixels * tile_pixels);
+		std::vector<uint32_t> samples(supersampling * supersampling);
 
-			// We may have an even distribution of samples and choose an invalid one in the previous loop
-			// If there was a valid sample we use it, if not then all samples are invalid and is safe to use it
-			if (best_sample == std::numeric_limits<uint32_t>::max())
-				best_sample = valid_sample;
+		for (uint32_t tile = next_tile++; tile < num_tiles; tile = next_tile++)
+			rasterize_tile(setups, bins, target, tile, buffer, samples, image);
+	});
 
-			indices_map[i * occlusion_map_width + j] = best_sample;
-		}
-	}
+	promise.set_value();
+}
 
-	delete[] index_map;
+std::future<void> rasterize_triangle_software(const mesh_t& mesh, image_u32& image, uint8_t supersampling)
+{
+	return async_apply(rasterize_software_helper, std::ref(mesh), std::ref(image), supersampling);
 }
-*/
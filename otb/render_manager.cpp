@@ -1,6 +1,7 @@
 #include "render_manager.hpp"
 
 #include "utils.hpp"
+#include "gl_utils.hpp"
 #include "configuration.hpp"
 
 #include "GL/gl3w.h"
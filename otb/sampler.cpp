@@ -0,0 +1,247 @@
+#include "sampler.hpp"
+
+#include "glm/gtc/constants.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+uint32_t hash_seed(uint32_t a, uint32_t b)
+{
+	// NOTE(Corralx): Combine the values and finalize with the 32 bits murmur3 mixer
+	uint32_t h = a ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2));
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static uint32_t reverse_bits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Hash that only propagates the bits upwards, so every bit depends on the lower ones only
+static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return x;
+}
+
+// Owen scrambling of a 0.32 fixed point value, each bit is flipped depending on the more significant ones
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+	return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The first two dimensions of the Sobol sequence as 0.32 fixed point values
+static uint32_t sobol_dimension_0(uint32_t index)
+{
+	return reverse_bits(index);
+}
+
+static uint32_t sobol_dimension_1(uint32_t index)
+{
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+		if (index & 1)
+			result ^= v;
+
+	return result;
+}
+
+static float to_unit_float(uint32_t x)
+{
+	// Keep only the bits a float can represent, so the result is always less than one
+	return static_cast<float>(x >> 8) * (1.f / 16777216.f);
+}
+
+sobol_sampler::sobol_sampler(uint32_t seed) :
+	_index_seed(hash_seed(seed, 0)), _x_seed(hash_seed(seed, 1)), _y_seed(hash_seed(seed, 2))
+{
+}
+
+glm::vec2 sobol_sampler::sample(uint32_t index) const
+{
+	// Scrambling the index shuffles the order of the points too, so any prefix of the sequence is well distributed
+	const uint32_t i = nested_uniform_scramble(index, _index_seed);
+
+	const uint32_t x = nested_uniform_scramble(sobol_dimension_0(i), _x_seed);
+	const uint32_t y = nested_uniform_scramble(sobol_dimension_1(i), _y_seed);
+	return { to_unit_float(x), to_unit_float(y) };
+}
+
+void sobol_sampler::sample(uint32_t first_index, uint32_t count, float* x, float* y) const
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const glm::vec2 u = sample(first_index + i);
+		x[i] = u.x;
+		y[i] = u.y;
+	}
+}
+
+// NOTE(Corralx): https://pathtracing.wordpress.com/2011/03/03/cosine-weighted-hemisphere/
+glm::vec3 cosine_weighted_hemisphere_sample(const glm::vec2& u, const glm::vec3& n, const glm::vec3& tangent, const glm::vec3& bitangent)
+{
+	const float sin_theta = std::sqrt(u.x);
+	const float cos_theta = std::sqrt(std::max(.0f, 1.f - u.x));
+	const float phi = 2.f * glm::pi<float>() * u.y;
+
+	const float xs = sin_theta * std::cos(phi);
+	const float zs = sin_theta * std::sin(phi);
+
+	// The frame is orthonormal, so the direction is already normalized
+	return xs * tangent + cos_theta * n + zs * bitangent;
+}
+
+// NOTE(Corralx): The angle 2 * pi * u is split in a quadrant and an offset in [-pi/4, pi/4], where short Taylor
+// polynomials are accurate to about 1e-7, then the sine and cosine of the offset are rotated into the quadrant
+static const float SIN_C3 = -1.f / 6.f;
+static const float SIN_C5 = 1.f / 120.f;
+static const float SIN_C7 = -1.f / 5040.f;
+static const float COS_C2 = -1.f / 2.f;
+static const float COS_C4 = 1.f / 24.f;
+static const float COS_C6 = -1.f / 720.f;
+static const float COS_C8 = 1.f / 40320.f;
+
+#if defined(__AVX2__)
+
+void cosine_weighted_hemisphere_sample_8(const float* u_x, const float* u_y, const glm::vec3& n, const glm::vec3& tangent,
+										 const glm::vec3& bitangent, float* direction_x, float* direction_y, float* direction_z)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 ux = _mm256_loadu_ps(u_x);
+	const __m256 uy = _mm256_loadu_ps(u_y);
+
+	const __m256 sin_theta = _mm256_sqrt_ps(ux);
+	const __m256 cos_theta = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(one, ux)));
+
+	// Quadrant and offset of the angle
+	const __m256 quarters = _mm256_mul_ps(uy, _mm256_set1_ps(4.f));
+	const __m256i quadrant = _mm256_cvtps_epi32(quarters);
+	const __m256 offset = _mm256_mul_ps(_mm256_sub_ps(quarters, _mm256_cvtepi32_ps(quadrant)), _mm256_set1_ps(glm::half_pi<float>()));
+	const __m256 offset2 = _mm256_mul_ps(offset, offset);
+
+	__m256 s = _mm256_set1_ps(SIN_C7);
+	s = _mm256_add_ps(_mm256_mul_ps(s, offset2), _mm256_set1_ps(SIN_C5));
+	s = _mm256_add_ps(_mm256_mul_ps(s, offset2), _mm256_set1_ps(SIN_C3));
+	s = _mm256_add_ps(_mm256_mul_ps(s, offset2), one);
+	s = _mm256_mul_ps(s, offset);
+
+	__m256 c = _mm256_set1_ps(COS_C8);
+	c = _mm256_add_ps(_mm256_mul_ps(c, offset2), _mm256_set1_ps(COS_C6));
+	c = _mm256_add_ps(_mm256_mul_ps(c, offset2), _mm256_set1_ps(COS_C4));
+	c = _mm256_add_ps(_mm256_mul_ps(c, offset2), _mm256_set1_ps(COS_C2));
+	c = _mm256_add_ps(_mm256_mul_ps(c, offset2), one);
+
+	// Odd quadrants swap sine and cosine, the sign bits come from the quadrant index
+	const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+	const __m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30));
+	const __m256 cos_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+
+	const __m256 sin_phi = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sin_sign);
+	const __m256 cos_phi = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cos_sign);
+
+	const __m256 xs = _mm256_mul_ps(sin_theta, cos_phi);
+	const __m256 zs = _mm256_mul_ps(sin_theta, sin_phi);
+
+	auto combine = [&](float t, float nn, float b)
+	{
+		__m256 d = _mm256_mul_ps(xs, _mm256_set1_ps(t));
+		d = _mm256_add_ps(d, _mm256_mul_ps(cos_theta, _mm256_set1_ps(nn)));
+		return _mm256_add_ps(d, _mm256_mul_ps(zs, _mm256_set1_ps(b)));
+	};
+
+	_mm256_storeu_ps(direction_x, combine(tangent.x, n.x, bitangent.x));
+	_mm256_storeu_ps(direction_y, combine(tangent.y, n.y, bitangent.y));
+	_mm256_storeu_ps(direction_z, combine(tangent.z, n.z, bitangent.z));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+void cosine_weighted_hemisphere_sample_8(const float* u_x, const float* u_y, const glm::vec3& n, const glm::vec3& tangent,
+										 const glm::vec3& bitangent, float* direction_x, float* direction_y, float* direction_z)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+
+	// Two halves of 4 lanes, blends are emulated with and/andnot since SSE2 lacks them
+	for (uint32_t half = 0; half < 8; half += 4)
+	{
+		const __m128 ux = _mm_loadu_ps(u_x + half);
+		const __m128 uy = _mm_loadu_ps(u_y + half);
+
+		const __m128 sin_theta = _mm_sqrt_ps(ux);
+		const __m128 cos_theta = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(one, ux)));
+
+		const __m128 quarters = _mm_mul_ps(uy, _mm_set1_ps(4.f));
+		const __m128i quadrant = _mm_cvtps_epi32(quarters);
+		const __m128 offset = _mm_mul_ps(_mm_sub_ps(quarters, _mm_cvtepi32_ps(quadrant)), _mm_set1_ps(glm::half_pi<float>()));
+		const __m128 offset2 = _mm_mul_ps(offset, offset);
+
+		__m128 s = _mm_set1_ps(SIN_C7);
+		s = _mm_add_ps(_mm_mul_ps(s, offset2), _mm_set1_ps(SIN_C5));
+		s = _mm_add_ps(_mm_mul_ps(s, offset2), _mm_set1_ps(SIN_C3));
+		s = _mm_add_ps(_mm_mul_ps(s, offset2), one);
+		s = _mm_mul_ps(s, offset);
+
+		__m128 c = _mm_set1_ps(COS_C8);
+		c = _mm_add_ps(_mm_mul_ps(c, offset2), _mm_set1_ps(COS_C6));
+		c = _mm_add_ps(_mm_mul_ps(c, offset2), _mm_set1_ps(COS_C4));
+		c = _mm_add_ps(_mm_mul_ps(c, offset2), _mm_set1_ps(COS_C2));
+		c = _mm_add_ps(_mm_mul_ps(c, offset2), one);
+
+		const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		const __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+		const __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+		const __m128 sin_phi = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sin_sign);
+		const __m128 cos_phi = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cos_sign);
+
+		const __m128 xs = _mm_mul_ps(sin_theta, cos_phi);
+		const __m128 zs = _mm_mul_ps(sin_theta, sin_phi);
+
+		auto combine = [&](float t, float nn, float b)
+		{
+			__m128 d = _mm_mul_ps(xs, _mm_set1_ps(t));
+			d = _mm_add_ps(d, _mm_mul_ps(cos_theta, _mm_set1_ps(nn)));
+			return _mm_add_ps(d, _mm_mul_ps(zs, _mm_set1_ps(b)));
+		};
+
+		_mm_storeu_ps(direction_x + half, combine(tangent.x, n.x, bitangent.x));
+		_mm_storeu_ps(direction_y + half, combine(tangent.y, n.y, bitangent.y));
+		_mm_storeu_ps(direction_z + half, combine(tangent.z, n.z, bitangent.z));
+	}
+}
+
+#else
+
+void cosine_weighted_hemisphere_sample_8(const float* u_x, const float* u_y, const glm::vec3& n, const glm::vec3& tangent,
+										 const glm::vec3& bitangent, float* direction_x, float* direction_y, float* direction_z)
+{
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		const glm::vec3 direction = cosine_weighted_hemisphere_sample({ u_x[i], u_y[i] }, n, tangent, bitangent);
+		direction_x[i] = direction.x;
+		direction_y[i] = direction.y;
+		direction_z[i] = direction.z;
+	}
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+// Mixes two 32 bits values into a well distributed seed
+uint32_t hash_seed(uint32_t a, uint32_t b = 0);
+
+// NOTE(Corralx): Owen scrambled 2D Sobol sequence, scrambled through hashing as in "Practical Hash-based Owen Scrambling"
+// Every seed gives an independent randomization that keeps the stratification of the sequence, so seeding
+// each texel differently decorrelates neighbouring texels without losing the low discrepancy of their samples
+class sobol_sampler
+{
+public:
+	explicit sobol_sampler(uint32_t seed);
+
+	// Returns the index-th point of the sequence in [0, 1)^2
+	glm::vec2 sample(uint32_t index) const;
+
+	// Writes the count points starting at first_index in SoA layout
+	void sample(uint32_t first_index, uint32_t count, float* x, float* y) const;
+
+private:
+	uint32_t _index_seed;
+	uint32_t _x_seed;
+	uint32_t _y_seed;
+};
+
+// Maps a point of the unit square to a direction in the hemisphere around n, with a density proportional to the cosine
+// The tangent and bitangent have to make an orthonormal frame with n
+glm::vec3 cosine_weighted_hemisphere_sample(const glm::vec2& u, const glm::vec3& n, const glm::vec3& tangent, const glm::vec3& bitangent);
+
+// Same as above for 8 points at once, the directions are written in SoA layout
+// NOTE(Corralx): Evaluated in SIMD registers with polynomial sine and cosine, so the frame is loaded only once per 8 rays
+void cosine_weighted_hemisphere_sample_8(const float* u_x, const float* u_y, const glm::vec3& n, const glm::vec3& tangent,
+										 const glm::vec3& bitangent, float* direction_x, float* direction_y, float* direction_z);
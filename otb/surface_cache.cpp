@@ -0,0 +1,157 @@
+#include "surface_cache.hpp"
+#include "occlusion.hpp"
+#include "mesh.hpp"
+#include "utils.hpp"
+#include "task_scheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+using image_u32 = image<pixel_format::U32>;
+
+struct image_tile
+{
+	image_tile(uint32_t x, uint32_t y) : starting_x(x), starting_y(y) {}
+
+	uint32_t starting_x;
+	uint32_t starting_y;
+};
+
+// Interleaves the bits of the tile coordinates, so that tiles close in the order are close in the image
+static uint64_t morton_code(uint32_t x, uint32_t y)
+{
+	auto spread_bits = [](uint64_t v)
+	{
+		v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+		v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+		v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		v = (v | (v << 2)) & 0x3333333333333333ull;
+		v = (v | (v << 1)) & 0x5555555555555555ull;
+		return v;
+	};
+
+	return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+static void build_surface_cache_helper(const mesh_t& mesh, const image_u32& indices_map, const occlusion_params& params,
+									   surface_cache& cache, glm::mat4 transform, std::promise<void> promise)
+{
+	assert(params.tile_width > 0 && params.tile_height > 0);
+
+	const uint32_t width = indices_map.width();
+	const uint32_t height = indices_map.height();
+	const uint32_t num_tile_width = (width + params.tile_width - 1) / params.tile_width;
+	const uint32_t num_tile_height = (height + params.tile_height - 1) / params.tile_height;
+
+	std::vector<std::pair<uint64_t, image_tile>> sorted_tiles;
+	sorted_tiles.reserve(num_tile_width * num_tile_height);
+	for (uint32_t tile_y = 0; tile_y < num_tile_height; ++tile_y)
+		for (uint32_t tile_x = 0; tile_x < num_tile_width; ++tile_x)
+			sorted_tiles.emplace_back(morton_code(tile_x, tile_y),
+									  image_tile(tile_x * params.tile_width, tile_y * params.tile_height));
+
+	std::sort(sorted_tiles.begin(), sorted_tiles.end(),
+			  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	const uint32_t num_tiles = static_cast<uint32_t>(sorted_tiles.size());
+	auto& scheduler = task_scheduler::instance();
+
+	// Visits the pixels of a tile, clamping the tiles on the border of the map
+	auto for_each_pixel = [&](const image_tile& tile, auto f)
+	{
+		const uint32_t ending_x = std::min(tile.starting_x + params.tile_width, width);
+		const uint32_t ending_y = std::min(tile.starting_y + params.tile_height, height);
+
+		for (uint32_t i = tile.starting_y; i < ending_y; ++i)
+			for (uint32_t j = tile.starting_x; j < ending_x; ++j)
+				if (indices_map[i * width + j] != std::numeric_limits<uint32_t>::max())
+					f(i, j);
+	};
+
+	// First pass: count the covered pixels of each tile to know where its texels start
+	std::vector<uint32_t> offsets(num_tiles + 1, 0);
+	scheduler.parallel_for(num_tiles, [&](uint32_t t)
+	{
+		uint32_t count = 0;
+		for_each_pixel(sorted_tiles[t].second, [&](uint32_t, uint32_t) { ++count; });
+		offsets[t + 1] = count;
+	});
+
+	for (uint32_t t = 0; t < num_tiles; ++t)
+		offsets[t + 1] += offsets[t];
+
+	const size_t num_texels = offsets[num_tiles];
+	cache.width = width;
+	cache.height = height;
+	cache.smooth_normal_interpolation = params.smooth_normal_interpolation;
+	cache.pixels.resize(num_texels);
+	cache.positions.resize(num_texels);
+	cache.normals.resize(num_texels);
+	cache.tangents.resize(num_texels);
+	cache.bitangents.resize(num_texels);
+
+	const auto faces = mesh.faces();
+	const auto tex_coords = mesh.texture_coords();
+	const auto positions = mesh.vertices();
+	const auto normals = mesh.normals();
+
+	// Normals go through the inverse transpose, so they stay orthogonal to the surface under non uniform scales
+	const glm::mat3 normal_transform = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+	// Second pass: reconstruct the surface under the center of each texel
+	scheduler.parallel_for(num_tiles, [&](uint32_t t)
+	{
+		size_t texel = offsets[t];
+		for_each_pixel(sorted_tiles[t].second, [&](uint32_t i, uint32_t j)
+		{
+			const face_t& face = faces[indices_map[i * width + j]];
+
+			// Calculate UV coordinates for the center of the current pixel
+			const glm::vec2 p_coord{ (j + .5f) / static_cast<float>(width),
+									 (i + .5f) / static_cast<float>(height) };
+
+			// Use baricentric interpolation to obtain the position and normal of the given pixel when projected on the mesh
+			// http://answers.unity3d.com/questions/383804/calculate-uv-coordinates-of-3d-point-on-plane-of-m.html
+			const glm::vec2 p0_coord = tex_coords[face.v0] - p_coord;
+			const glm::vec2 p1_coord = tex_coords[face.v1] - p_coord;
+			const glm::vec2 p2_coord = tex_coords[face.v2] - p_coord;
+
+			const float area_tris = glm::length(glm::cross(glm::vec3(p0_coord - p1_coord, .0f), glm::vec3(p0_coord - p2_coord, .0f)));
+			const float area0 = glm::length(glm::cross(glm::vec3(p1_coord, .0f), glm::vec3(p2_coord, .0f))) / area_tris;
+			const float area1 = glm::length(glm::cross(glm::vec3(p2_coord, .0f), glm::vec3(p0_coord, .0f))) / area_tris;
+			const float area2 = glm::length(glm::cross(glm::vec3(p0_coord, .0f), glm::vec3(p1_coord, .0f))) / area_tris;
+
+			const glm::vec3 p = glm::vec3(transform * glm::vec4(positions[face.v0] * area0 + positions[face.v1] * area1 +
+															   positions[face.v2] * area2, 1.f));
+
+			// Setting smooth_normal_interpolation to false will just take the mean value of the normals
+			glm::vec3 n;
+			if (params.smooth_normal_interpolation)
+				n = normals[face.v0] * area0 + normals[face.v1] * area1 + normals[face.v2] * area2;
+			else
+				n = (normals[face.v0] + normals[face.v1] + normals[face.v2]) / 3.f;
+			n = glm::normalize(normal_transform * n);
+
+			glm::vec3 tangent;
+			glm::vec3 bitangent;
+			orthonormal_basis(n, tangent, bitangent);
+
+			cache.pixels[texel] = i * width + j;
+			cache.positions.set(texel, p);
+			cache.normals.set(texel, n);
+			cache.tangents.set(texel, tangent);
+			cache.bitangents.set(texel, bitangent);
+			++texel;
+		});
+	});
+
+	promise.set_value();
+}
+
+std::future<void> build_surface_cache(const mesh_t& mesh, const image_u32& indices_map,
+									  const occlusion_params& params, surface_cache& cache, const glm::mat4& transform)
+{
+	return async_apply(build_surface_cache_helper, std::ref(mesh), std::ref(indices_map), std::ref(params), std::ref(cache), transform);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "image.hpp"
+#include "glm/glm.hpp"
+
+class mesh_t;
+struct occlusion_params;
+
+// Three float streams, one per component
+struct vec3_stream
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	void resize(size_t size)
+	{
+		x.resize(size);
+		y.resize(size);
+		z.resize(size);
+	}
+
+	void set(size_t index, const glm::vec3& v)
+	{
+		x[index] = v.x;
+		y[index] = v.y;
+		z[index] = v.z;
+	}
+
+	glm::vec3 get(size_t index) const
+	{
+		return { x[index], y[index], z[index] };
+	}
+};
+
+// Surface data of every texel covered by the UV unwrap of a mesh rasterized at a given resolution
+// The normal, tangent and bitangent make an orthonormal frame used to orient the hemisphere samples
+/* NOTE(Corralx): The cache depends only on the mesh, its transform, the indices map and the geometric parameters
+   (tile size and normal interpolation), so it can be reused by any bake changing the other parameters
+   The interpolation is recorded so a bake with different params is caught, the tile size changes only the order */
+struct surface_cache
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	bool smooth_normal_interpolation = true;
+
+	// Texels are stored in Morton tile order to keep neighbouring texels close in memory
+	std::vector<uint32_t> pixels;
+	vec3_stream positions;
+	vec3_stream normals;
+	vec3_stream tangents;
+	vec3_stream bitangents;
+
+	size_t size() const
+	{
+		return pixels.size();
+	}
+
+	size_t memory() const
+	{
+		return pixels.size() * (sizeof(uint32_t) + 12 * sizeof(float));
+	}
+};
+
+// When the future is ready, the cache contains the surface data of every covered texel of the indices map
+// The surface is moved by the transform, so the cache of an instance is in the world space of its scene
+std::future<void> build_surface_cache(const mesh_t& mesh, const image<pixel_format::U32>& indices_map,
+									  const occlusion_params& params, surface_cache& cache,
+									  const glm::mat4& transform = glm::mat4(1.f));
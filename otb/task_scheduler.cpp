@@ -0,0 +1,126 @@
+#include "task_scheduler.hpp"
+
+#include "elektra/machine_specs.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+// Index of the worker owning the current thread, or NO_WORKER for external threads
+static constexpr uint32_t NO_WORKER = UINT32_MAX;
+static thread_local uint32_t current_worker = NO_WORKER;
+static thread_local const task_scheduler* current_scheduler = nullptr;
+
+task_scheduler& task_scheduler::instance()
+{
+	static task_scheduler scheduler(std::max(1u, static_cast<uint32_t>(elk::number_of_cores())));
+	return scheduler;
+}
+
+task_scheduler::task_scheduler(uint32_t worker_num) : _queues(), _workers(), _pending(0), _next_queue(0), _stop(false)
+{
+	assert(worker_num > 0);
+
+	for (uint32_t i = 0; i < worker_num; ++i)
+		_queues.push_back(std::make_unique<worker_queue>());
+
+	for (uint32_t i = 0; i < worker_num; ++i)
+		_workers.emplace_back(&task_scheduler::worker_loop, this, i);
+}
+
+task_scheduler::~task_scheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(_sleep_mutex);
+		_stop = true;
+	}
+	_sleep_cv.notify_all();
+
+	for (auto& w : _workers)
+		w.join();
+}
+
+void task_scheduler::submit(task t)
+{
+	const bool own_worker = current_scheduler == this && current_worker != NO_WORKER;
+	const uint32_t index = own_worker ? current_worker : _next_queue++ % worker_count();
+
+	{
+		worker_queue& queue = *_queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(t));
+	}
+
+	// NOTE(Corralx): Taking the lock avoids losing the wakeup of a worker about to sleep
+	_pending.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(_sleep_mutex);
+	}
+	_sleep_cv.notify_one();
+}
+
+task task_scheduler::pop_task(uint32_t first_queue, bool from_back)
+{
+	const uint32_t num_queues = worker_count();
+	for (uint32_t i = 0; i < num_queues; ++i)
+	{
+		const uint32_t index = (first_queue + i) % num_queues;
+		worker_queue& queue = *_queues[index];
+
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		// Only the owner takes the most recent task, thieves take the oldest one
+		task t;
+		if (from_back && i == 0)
+		{
+			t = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			t = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+
+		_pending.fetch_sub(1);
+		return t;
+	}
+
+	return task();
+}
+
+bool task_scheduler::run_pending_task()
+{
+	const bool own_worker = current_scheduler == this && current_worker != NO_WORKER;
+	const uint32_t first_queue = own_worker ? current_worker : _next_queue++ % worker_count();
+
+	task t = pop_task(first_queue, own_worker);
+	if (!t)
+		return false;
+
+	t();
+	return true;
+}
+
+void task_scheduler::worker_loop(uint32_t index)
+{
+	current_worker = index;
+	current_scheduler = this;
+
+	while (true)
+	{
+		task t = pop_task(index, true);
+		if (t)
+		{
+			t();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleep_mutex);
+		_sleep_cv.wait(lock, [this]() { return _stop || _pending > 0; });
+
+		if (_stop)
+			return;
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Move only type erased callable, so tasks can own promises and other move only state
+class task
+{
+	struct concept_t
+	{
+		virtual ~concept_t() = default;
+		virtual void run() = 0;
+	};
+
+	template<typename Func>
+	struct model_t : concept_t
+	{
+		model_t(Func&& f) : func(std::move(f)) {}
+		void run() override { func(); }
+
+		Func func;
+	};
+
+public:
+	task() = default;
+
+	template<typename Func, typename = std::enable_if_t<!std::is_same<std::decay_t<Func>, task>::value>>
+	task(Func f) : _impl(std::make_unique<model_t<Func>>(std::move(f))) {}
+
+	task(const task&) = delete;
+	task(task&&) = default;
+	task& operator=(const task&) = delete;
+	task& operator=(task&&) = default;
+
+	~task() = default;
+
+	void operator()()
+	{
+		_impl->run();
+	}
+
+	explicit operator bool() const
+	{
+		return _impl != nullptr;
+	}
+
+private:
+	std::unique_ptr<concept_t> _impl;
+};
+
+// NOTE(Corralx): Process wide pool of workers, each one owning a deque of tasks
+// A worker pops from the back of its own deque and steals from the front of the others when empty
+class task_scheduler
+{
+	struct worker_queue
+	{
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+
+public:
+	// Lazily created on first use with a worker per core
+	static task_scheduler& instance();
+
+	explicit task_scheduler(uint32_t worker_num);
+	~task_scheduler();
+
+	task_scheduler(const task_scheduler&) = delete;
+	task_scheduler(task_scheduler&&) = delete;
+	task_scheduler& operator=(const task_scheduler&) = delete;
+	task_scheduler& operator=(task_scheduler&&) = delete;
+
+	uint32_t worker_count() const
+	{
+		return static_cast<uint32_t>(_queues.size());
+	}
+
+	// Tasks submitted from a worker go to its own deque, the others are distributed round robin
+	void submit(task t);
+
+	// Runs f(i) for every i in [0, count) and returns when all of them are done
+	// NOTE(Corralx): The calling thread executes pending tasks while waiting, so this is safe to call from a task
+	template<typename Func>
+	void parallel_for(uint32_t count, Func f)
+	{
+		if (count == 0)
+			return;
+
+		std::atomic<uint32_t> remaining(count - 1);
+		for (uint32_t i = 1; i < count; ++i)
+		{
+			submit([&f, &remaining, i]()
+			{
+				f(i);
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+		}
+
+		f(0);
+
+		while (remaining.load(std::memory_order_acquire) > 0)
+		{
+			if (!run_pending_task())
+				std::this_thread::yield();
+		}
+	}
+
+	// Blocks until the future is ready, executing pending tasks in the meantime
+	// NOTE(Corralx): Use this instead of future::get() inside a task, or a worker could sleep on work queued behind it
+	template<typename T>
+	void wait(const std::future<T>& future)
+	{
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if (!run_pending_task())
+				std::this_thread::yield();
+		}
+	}
+
+	// Executes a single queued task on the calling thread, returns false if none was found
+	bool run_pending_task();
+
+private:
+	void worker_loop(uint32_t index);
+	task pop_task(uint32_t first_queue, bool from_back);
+
+	std::vector<std::unique_ptr<worker_queue>> _queues;
+	std::vector<std::thread> _workers;
+
+	std::atomic<int32_t> _pending;
+	std::atomic<uint32_t> _next_queue;
+	std::atomic<bool> _stop;
+
+	std::mutex _sleep_mutex;
+	std::condition_variable _sleep_cv;
+};
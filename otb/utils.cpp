@@ -1,11 +1,10 @@
 #include "utils.hpp"
 
 #include "mesh.hpp"
+#include "mesh_binary.hpp"
+#include "obj_loader.hpp"
 
-#include "tinyobjloader/tiny_obj_loader.h"
 #include "elektra/filesystem.hpp"
-#include "elektra/file_io.hpp"
-#include "GL/gl3w.h"
 #include "glm/gtc/constants.hpp"
 
 #pragma warning (push, 0)
@@ -13,117 +12,38 @@
 #include "stb/stb_image_write.h"
 #pragma warning (pop)
 
+#include <cstring>
+#include <cassert>
 #include <random>
 
 // TODO(Corralx): Signal errors in some way
-// TODO(Corralx): Calculate smooth normals if not present
-static void load_meshes_helper(const elk::path& path, std::vector<mesh_t>& meshes)
+static void load_meshes_helper(const elk::path& path, std::vector<mesh_t>& meshes, bool verify)
 {
-	if (path.empty() || !elk::exists(path) || path.extension() != ".obj")
+	if (path.empty() || !elk::exists(path))
 		return;
 
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-		
-	std::string error;
-	bool result = tinyobj::LoadObj(shapes, materials, error, path.c_str());
-	if (!result)
-		return;
-
-	for (uint32_t i = 0; i < shapes.size(); ++i)
-	{
-		tinyobj::mesh_t& tiny_mesh = shapes[i].mesh;
-
-		size_t num_vertices = tiny_mesh.positions.size() / 3;
-		size_t num_normals = tiny_mesh.normals.size() / 3;
-		size_t num_tex_coords = tiny_mesh.texcoords.size() / 2;
-		size_t num_tris = tiny_mesh.indices.size() / 3;
-
-		if (num_vertices == 0 || num_tris == 0 || num_normals != num_vertices || num_tex_coords != num_vertices)
-			continue;
-
-		std::vector<vertex_t> vertices(num_vertices);
-		memcpy(vertices.data(), tiny_mesh.positions.data(), sizeof(vertex_t) * num_vertices);
-		std::vector<normal_t> normals(num_normals);
-		memcpy(normals.data(), tiny_mesh.normals.data(), sizeof(normal_t) * num_normals);
-		std::vector<texture_coord_t> coords(num_tex_coords);
-		memcpy(coords.data(), tiny_mesh.texcoords.data(), sizeof(texture_coord_t) * num_tex_coords);
-		std::vector<face_t> faces(num_tris);
-		memcpy(faces.data(), tiny_mesh.indices.data(), sizeof(face_t) * num_tris);
-
-		material_t material{};
-		material.color = random_color();
-		material.state = material_t::state_t::BASE;
-
-		bindings_t bindings{};
-		// TODO(Corralx)
-
-		mesh_t mesh(std::move(vertices), std::move(normals), std::move(coords), std::move(faces));
-		meshes.push_back(std::move(mesh));
-	}
+	if (path.extension() == ".otbm")
+		load_meshes_binary(path, meshes, verify);
+	else if (path.extension() == ".obj")
+		load_obj(path, meshes);
 }
 
-std::vector<mesh_t> load_meshes(const elk::path& path)
+std::vector<mesh_t> load_meshes(const elk::path& path, bool verify)
 {
 	std::vector<mesh_t> meshes;
-	load_meshes_helper(path, meshes);
-	return std::move(meshes);
+	load_meshes_helper(path, meshes, verify);
+	return meshes;
 }
 
-static void load_meshes_async_helper(const elk::path& path, std::vector<mesh_t>& meshes, std::promise<void> promise)
+static void load_meshes_async_helper(const elk::path& path, std::vector<mesh_t>& meshes, bool verify, std::promise<void> promise)
 {
-	load_meshes_helper(path, meshes);
+	load_meshes_helper(path, meshes, verify);
 	promise.set_value();
 }
 
-std::future<void> load_meshes_async(const elk::path& path, std::vector<mesh_t>& meshes)
+std::future<void> load_meshes_async(const elk::path& path, std::vector<mesh_t>& meshes, bool verify)
 {
-	return async_apply(load_meshes_async_helper, std::ref(path), std::ref(meshes));
-}
-
-// NOTE(Corralx): An OpenGL context must be bound to the current thread for this to work
-elk::optional<uint32_t> load_program(const elk::path& vs_path, const elk::path& fs_path, elk::optional<elk::path> gs_path)
-{
-	auto vs_source = elk::get_content_of_file(vs_path);
-	auto fs_source = elk::get_content_of_file(fs_path);
-	auto gs_source = gs_path ? elk::get_content_of_file(gs_path.value()) : elk::nullopt;
-
-	if (!vs_source || !fs_source)
-		return elk::nullopt;
-
-	uint32_t program = glCreateProgram();
-
-	const char* vs_ptr = vs_source.value().c_str();
-	uint32_t vs = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vs, 1, &vs_ptr, nullptr);
-	glCompileShader(vs);
-	glAttachShader(program, vs);
-
-	const char* fs_ptr = fs_source.value().c_str();
-	uint32_t fs = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fs, 1, &fs_ptr, nullptr);
-	glCompileShader(fs);
-	glAttachShader(program, fs);
-
-	uint32_t gs = 0;
-	if (gs_source)
-	{
-		const char* gs_ptr = gs_source.value().c_str();
-		gs = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(gs, 1, &gs_ptr, nullptr);
-		glCompileShader(gs);
-		glAttachShader(program, gs);
-	}
-
-	glLinkProgram(program);
-
-	glDeleteShader(vs);
-	if (gs != 0)
-		glDeleteShader(gs);
-	glDeleteShader(fs);
-
-	assert(glGetError() == GL_NO_ERROR);
-	return program;
+	return async_apply(load_meshes_async_helper, std::ref(path), std::ref(meshes), verify);
 }
 
 template<>
@@ -205,28 +125,8 @@ bool point_in_tris(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b, c
 	return same_side(p, a, b, c) && same_side(p, b, a, c) && same_side(p, c, a, b);
 }
 
-static double random_double()
-{
-	static std::random_device rd;
-	static std::mt19937 gen(rd());
-	static std::uniform_real_distribution<> dist(.0f, 1.f);
-
-	return dist(gen);
-}
-
-// NOTE(Corralx): https://pathtracing.wordpress.com/2011/03/03/cosine-weighted-hemisphere/
-glm::vec3 cosine_weighted_hemisphere_sample(glm::vec3 n)
+void orthonormal_basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
 {
-	double xi1 = random_double();
-	double xi2 = random_double();
-
-	double  theta = acos(sqrt(1.0 - xi1));
-	double  phi = 2.0 * glm::pi<double>() * xi2;
-
-	float xs = static_cast<float>(sin(theta) * cos(phi));
-	float ys = static_cast<float>(cos(theta));
-	float zs = static_cast<float>(sin(theta) * sin(phi));
-
 	glm::vec3 h = n;
 	if (abs(h.x) <= abs(h.y) && abs(h.x) <= abs(h.z))
 		h.x = 1.0;
@@ -235,11 +135,8 @@ glm::vec3 cosine_weighted_hemisphere_sample(glm::vec3 n)
 	else
 		h.z = 1.0;
 
-	glm::vec3 x = glm::normalize(glm::cross(h, n));
-	glm::vec3 z = glm::normalize(glm::cross(x, n));
-
-	glm::vec3 direction = xs * x + ys * n + zs * z;
-	return glm::normalize(direction);
+	tangent = glm::normalize(glm::cross(h, n));
+	bitangent = glm::normalize(glm::cross(tangent, n));
 }
 
 std::vector<float> generate_gaussian_kernel_1d(float sigma, uint32_t kernel_size)
@@ -266,7 +163,7 @@ std::vector<float> generate_gaussian_kernel_1d(float sigma, uint32_t kernel_size
 	for (uint32_t i = 0; i < kernel_size; ++i)
 		kernel[i] /= weight_sum;
 
-	return std::move(kernel);
+	return kernel;
 }
 
 uint32_t generate_unique_index()
@@ -275,18 +172,56 @@ uint32_t generate_unique_index()
 	return next_free_index++;
 }
 
-void update_texture_data(material_t mat, const image<pixel_format::F32>& image)
+static uint64_t rotate_left(uint64_t x, uint32_t r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// NOTE(Corralx): Single lane variant of the 64 bits murmur3 body, consuming 8 bytes per step
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
 {
-	int32_t last_texture;
-	glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
+	const uint64_t c1 = 0x87c37b91114253d5ull;
+	const uint64_t c2 = 0x4cf5ad432745937full;
 
-	glBindTexture(GL_TEXTURE_2D, mat.texture_id);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width(), image.height(), GL_RED, GL_FLOAT, image.raw());
+	auto mix_word = [&](uint64_t h, uint64_t word)
+	{
+		word *= c1;
+		word = rotate_left(word, 31);
+		word *= c2;
+		h ^= word;
+		return rotate_left(h, 27) * 5 + 0x52dce729;
+	};
 
-	glBindTexture(GL_TEXTURE_2D, last_texture);
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t h = seed ^ (size * c1);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		h = mix_word(h, word);
+	}
+
+	uint64_t tail = 0;
+	for (size_t j = 0; i + j < size; ++j)
+		tail |= static_cast<uint64_t>(bytes[i + j]) << (8 * j);
+	h = mix_word(h, tail);
+
+	// Final avalanche
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
 }
 
 glm::vec3 random_color()
 {
-	return { (float)random_double(), (float)random_double(), (float)random_double() };
+	// NOTE(Corralx): Only used to tell the meshes apart in the viewer, so the colors need not be reproducible
+	thread_local std::mt19937 gen(std::random_device{}());
+	std::uniform_real_distribution<float> dist(.0f, 1.f);
+
+	return { dist(gen), dist(gen), dist(gen) };
 }
@@ -2,26 +2,24 @@
 
 #include "image.hpp"
 #include "material.hpp"
+#include "task_scheduler.hpp"
 
-#include "elektra/optional.hpp"
 #include "elektra/filesystem/path.hpp"
 #include "glm/glm.hpp"
 
 #include <cstdint>
-#include <future>
 #include <array>
 #include <vector>
-#include <thread>
 #include <future>
+#include <tuple>
+#include <utility>
 
 class mesh_t;
 
 // TODO(Corralx): Found a generic way to return an error
-std::vector<mesh_t> load_meshes(const elk::path& path);
-std::future<void> load_meshes_async(const elk::path& path, std::vector<mesh_t>& meshes);
-
-elk::optional<uint32_t> load_program(const elk::path& vs_path, const elk::path& fs_path,
-									 elk::optional<elk::path> gs_path = elk::nullopt);
+// Verify fully checks binary meshes on load instead of only their layout, see load_meshes_binary
+std::vector<mesh_t> load_meshes(const elk::path& path, bool verify = false);
+std::future<void> load_meshes_async(const elk::path& path, std::vector<mesh_t>& meshes, bool verify = false);
 
 enum class image_extension : uint8_t
 {
@@ -36,11 +34,10 @@ bool write_image(const elk::path& path, const image<F>& image, image_extension e
 
 bool write_image(const elk::path& path, const image<pixel_format::F32>& image);
 
-// TODO(Corralx): Functions to convert between formats (like R32 -> U8)
-
 bool point_in_tris(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c);
 
-glm::vec3 cosine_weighted_hemisphere_sample(glm::vec3 n);
+// Builds two unit vectors orthogonal to the unit vector n and to each other
+void orthonormal_basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent);
 
 std::vector<float> generate_gaussian_kernel_1d(float sigma, uint32_t kernel_size);
 
@@ -63,18 +60,36 @@ bool is_ready(const std::future<T>& f)
 	return f.wait_for(0) == std::future_status::ready;
 }
 
+namespace detail
+{
+
+template<typename Func, typename Tuple, size_t... I>
+void invoke_unpacked(Func& f, Tuple& args, std::index_sequence<I...>)
+{
+	f(std::move(std::get<I>(args))...);
+}
+
+}
+
+// NOTE(Corralx): Arguments are decay copied like std::thread does, use std::ref to pass references
 template<typename Func, typename ...Args>
 std::future<void> async_apply(Func f, Args&&... args)
 {
 	std::promise<void> promise;
 	std::future<void> future = promise.get_future();
-	std::thread(f, std::forward<Args>(args)..., std::move(promise)).detach();
+
+	std::tuple<std::decay_t<Args>..., std::promise<void>> arguments(std::forward<Args>(args)..., std::move(promise));
+	task_scheduler::instance().submit([f, arguments = std::move(arguments)]() mutable
+	{
+		detail::invoke_unpacked(f, arguments, std::make_index_sequence<sizeof...(Args) + 1>());
+	});
 
 	return future;
 }
 
 uint32_t generate_unique_index();
 
-void update_texture_data(material_t mat, const image<pixel_format::F32>& image);
+// Non cryptographic 64 bits hash of a buffer, pass the previous hash as seed to chain several buffers
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
 
 glm::vec3 random_color();